@@ -0,0 +1,36 @@
+#ifndef _BOARD_H
+#define _BOARD_H
+
+#include "machine.h"
+
+/*
+    Description of the Space Invaders board: its memory layout and what
+    each of its I/O ports does, as X macros. machine.c sets the CPU's
+    memory map and port handlers up from it, and a CPU core built with
+    CPU_BOARD compiles it into its handlers, so memory is read without
+    the map and IN and OUT run the port's code in place of a call.
+*/
+
+//8K of ROM then 8K of RAM. only 14 address lines are decoded, so the
+//16K repeats through the rest of the address space.
+#define BOARD_MEMORY 0x4000
+#define BOARD_ROM 0x2000
+
+//X(port, the byte IN reads from it), with the machine as m
+#define BOARD_IN_PORTS(X) \
+    X(0, m->button_inputs[0]) \
+    X(1, m->button_inputs[1]) \
+    X(2, m->button_inputs[2]) \
+    X(3, (m->shift_reg >> (8 - m->shift_amt)) & 0xff) /* shift result */
+
+//X(port, what OUT does with the byte val written to it), with the
+//machine as m. ports that do nothing yet (sound and the watchdog) are
+//listed with nothing to do.
+#define BOARD_OUT_PORTS(X) \
+    X(2, m->shift_amt = val & 7) /* shift amount (3 bits) */ \
+    X(3, ) /* sound */ \
+    X(4, m->shift_reg = m->shift_reg >> 8 | val << 8) /* shift data */ \
+    X(5, ) /* sound */ \
+    X(6, ) /* watchdog */
+
+#endif //_BOARD_H
@@ -1,943 +1,3401 @@
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
-#include <stdlib.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "cpu.h"
+#include "opcodes.h"
+
+//a core for the Space Invaders board alone, whose handlers have its
+//memory layout and ports built in (see board.h). every state must then
+//be a Machine's.
+#ifdef CPU_BOARD
+#include "board.h"
+#endif
+
+//the JIT is only built for x86-64 hosts, and not with CPU_CHECKS
+#if defined(CPU_JIT) && defined(__x86_64__) && defined(__GNUC__) && \
+    !defined(CPU_CHECKS)
+#define JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+//size of the address space, and of a page in the memory map
+#define ADDRESS_SPACE 0x10000
+#define PAGE_SIZE 0x100
+
+//size of a host cache line, and n rounded up to a whole number of them
+#define CACHE_LINE 64
+#define LINES(n) (((n) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE)
+
+_Static_assert(offsetof(CPUState, ports) <= CACHE_LINE,
+               "the state used as the CPU runs must fit in one cache line");
+
+//how an instruction handler finished: by going on to the instruction
+//after it, by branching (with pc set by the handler, or left alone by
+//HLT), or on a trap. the opcode table says how many bytes and cycles
+//each takes.
+typedef enum OpEnd { OP_NEXT, OP_TAKEN, OP_TRAPPED } OpEnd;
+
+//an instruction handler, and the same with its opcode's length and
+//cycles built in (see STEP_FUNCTION)
+typedef OpEnd (*OpHandler)(CPUState *state, byte *opcode);
+typedef struct OpStats OpStats;
+typedef OpStats (*OpStep)(CPUState *state, byte *opcode);
+
+//what stepCPU, runCPU and interruptCPU run on (see the Cores section)
+struct CPUCore {
+    int (*step)(CPUState *state);
+    int (*run)(CPUState *state, int cycle_budget);
+    int (*interrupt)(CPUState *state, byte opcode);
+};
+
+//an instruction as the decode cache keeps it
+typedef struct DecodedOp {
+    OpStep handler; //NULL if not decoded
+    byte bytes[3]; //opcode and operands, as the handler is given them
+    byte len; //length in bytes
+    byte cycles; //cycles taken (when a conditional branch is not)
+    byte hits; //times runCPU has reached it outside translated code
+    byte in_block; //set if it is part of a translated block
+    //the threaded block starting here, if any. in a shared page (see
+    //SharedCode), this is set once by whichever state translates it
+    //first, and the rest are left alone.
+    _Atomic(struct Block *) block;
+} DecodedOp;
+
+//an instruction in a threaded block: its handler and operands, ready
+//to call, where it is and how far into the block
+typedef struct BlockOp {
+    OpHandler handler;
+    byte bytes[3];
+    uint16_t pc;
+    uint16_t cycles; //cycles the block has taken before it
+} BlockOp;
+
+typedef struct Block {
+    struct Block *next; //on the list of dropped blocks
+    int nops;
+    BlockOp ops[];
+} Block;
+
+typedef struct Jit Jit;
+
+struct DecodeCache {
+    //decoded instructions for each page, allocated the first time one
+    //on the page is decoded, and the list of pages that have them
+    DecodedOp *ops[256];
+    byte code_pages[256];
+    int ncode;
+    //host memory for pages whose writes are watched for changes to
+    //decoded instructions, NULL for others. the write pointers of
+    //these pages are taken out of the map while they are watched.
+    byte *watched[256];
+    //pages whose host memory is watched because code is read from it
+    byte code_watched[256];
+    //set if a decoded instruction can be changed by writes to a page
+    //other than its own (through a mirror, say)
+    int aliased;
+    //somewhere to decode instructions that can't be cached
+    DecodedOp uncached;
+    //set if runCPU runs threaded blocks
+    int threaded;
+    //translated code, if the JIT is on
+    Jit *jit;
+    //set when a write drops translated code
+    int dropped;
+    //dropped blocks, which are only freed once they can't be running
+    Block *dead;
+    //the code shared with other states, if any, and this state's own
+    //hit counts for each page it has taken from there (which is NULL
+    //for pages it hasn't)
+    SharedCode *shared;
+    byte *shared_hits[256];
+};
+
+/*
+    Shared code. A page that no page of the address space writes to
+    (ROM, in other words) decodes the same way in every state that has
+    the same bytes there, so states given the same SharedCode take such
+    pages' decoded instructions and threaded blocks from it, rather than
+    each keeping its own. Pages are kept in a list for each page number,
+    and found by their bytes. A state adds a page it doesn't find by
+    decoding all of it and pushing it onto the list with a compare and
+    swap, so looking a page up never waits on another state. Threaded
+    blocks are published the same way, and nothing else in a shared
+    page changes once it is on the list. How often each instruction has
+    run is counted by each state for itself, and JIT code is still
+    translated by each state, as it is linked to the state's own blocks.
+*/
+typedef struct SharedPage {
+    struct SharedPage *next;
+    byte code[PAGE_SIZE]; //the bytes it was decoded from
+    //instructions that run into the next page aren't decoded, and are
+    //decoded each time they run instead
+    DecodedOp ops[PAGE_SIZE];
+} SharedPage;
+
+struct SharedCode {
+    _Atomic(SharedPage *) pages[256];
+    atomic_int refs;
+};
+
+#ifdef JIT_X86_64
+static void jit_flush(Jit *j, DecodeCache *dc);
+static void jit_drop_page(Jit *j, int page);
+static void jit_destroy(Jit *j);
+#endif
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define NOINLINE __attribute__((noinline))
+#define LIKELY(x) __builtin_expect(!!(x), 1)
+#else
+#define ALWAYS_INLINE inline
+#define NOINLINE
+#define LIKELY(x) (x)
+#endif
 
 CPUState *newState(unsigned int mem_size) {
-    CPUState *cs = malloc(sizeof(CPUState));
-    cs->fl.z = 0;
-    cs->fl.s = 0;
-    cs->fl.p = 0;
-    cs->fl.cy = 0;
-    cs->fl.ac = 0;
-    cs->fl.pad = 0;
+    return newStateWithHost(mem_size, 0);
+}
 
-    for (int r = 0; r < 7; r++) {
-        cs->reg[r] = 0;
-    }
+//one block, starting on a cache line, holds the state (with the part
+//used as the CPU runs in that first line), then the host's state, the
+//memory map and RAM, each on lines of their own
+CPUState *newStateWithHost(unsigned int mem_size, size_t host_size) {
+    size_t host_at = LINES(sizeof(CPUState));
+    size_t map_at = host_at + LINES(host_size);
+    size_t memory_at = map_at + LINES(sizeof(MemoryMap));
+    byte *block = aligned_alloc(CACHE_LINE, memory_at + ADDRESS_SPACE);
+    memset(block, 0, memory_at + ADDRESS_SPACE);
 
-    for (int port = 0; port < 256; port++) {
-        cs->ports[port] = 0;
-    }
+    CPUState *cs = (CPUState *) block;
+    cs->fl.psw = 0x02; //all clear
+    cs->lf = LF_PSW | 0x02; //the same, as set directly
+
+    cs->a = 0;
+    cs->bc = 0;
+    cs->de = 0;
+    cs->hl = 0;
 
     cs->pc = 0;
     cs->sp = 0;
     cs->int_enable = 0;
+    cs->halted = 0;
 
-    cs->memory = (byte *) calloc(mem_size, sizeof(byte));
+    cs->memory = block + memory_at;
     cs->mem_size = mem_size;
+    cs->map = (MemoryMap *) (block + map_at);
+    cs->map->read_handler = NULL;
+    cs->map->write_handler = NULL;
+    cs->map->ctx = NULL;
+    cs->decoded = NULL;
+    cs->aot = 0;
+    setCPUHooks(cs, NULL);
+    mapPages(cs, 0, ADDRESS_SPACE / PAGE_SIZE, cs->memory, cs->memory);
+    cs->trap = TRAP_NONE;
 
-    //I/O bus
+    //I/O bus (the ports start out 0)
     cs->write_flag = -1;
+    cs->host = host_size ? block + host_at : NULL;
 
     return cs;
 }
 
 void destroyState(CPUState *cs) {
-    free(cs->memory);
+    if (cs->decoded) {
+        flushDecodeCache(cs);
+#ifdef JIT_X86_64
+        if (cs->decoded->jit) jit_destroy(cs->decoded->jit);
+#endif
+        releaseSharedCode(cs->decoded->shared);
+        free(cs->decoded);
+    }
     free(cs);
 }
 
-//handling for unimplemented ops
-static void unknownOp(CPUState *cs) {
-    fprintf(stderr, "Error: unimplemented instruction. Exiting...\n");
-    fprintf(stderr, "Program counter is %04x\n", cs->pc);
-    exit(1);
+void mapPages(CPUState *cs, int first, int npages, byte *read, byte *write) {
+    //decoded instructions may no longer be what is at their address
+    if (cs->decoded) flushDecodeCache(cs);
+    cs->map->window_first = cs->map->window_last = -1;
+    for (int i = 0; i < npages; i++) {
+        cs->map->read[first + i] = read ? read + i * PAGE_SIZE : NULL;
+        cs->map->write[first + i] = write ? write + i * PAGE_SIZE : NULL;
+        cs->map->clean[first + i] = NULL;
+        if (cs->map->track_dirty) cs->map->dirty[first + i] = 1;
+    }
+}
+
+void mapPort(CPUState *cs, byte port, PortInHandler in, PortOutHandler out) {
+    cs->map->in[port] = in;
+    cs->map->out[port] = out;
 }
 
 // helper functions
-static byte arithmeticOperand(uint16_t atype, CPUState *state) {
-    byte r2;
-    if (atype < 6) { //b, c, d, e, h, l addto a
-        r2 = state->reg[atype + 1];
-    } else if (atype == 7) {
-        r2 = state->reg[0];
-    } else {
-        //hl is a memory address
-        uint16_t adr = ((uint16_t) state->reg[5] << 8) | (state->reg[6]);
-        r2 = state->memory[adr];
+
+//memory accesses go through the page map. pages without host memory
+//are handled out of line, so the common case is a table load and a
+//branch that is never taken.
+static NOINLINE byte read_slow(CPUState *state, uint16_t adr) {
+    MemoryMap *map = state->map;
+    if (map->read_handler) return map->read_handler(map->ctx, adr);
+    return 0xff;
+}
+
+static void invalidate_code(MemoryMap *map, DecodeCache *dc,
+                            int page, int offset);
+
+//the host memory a page writes to, whether or not dirty page tracking
+//or the decode cache has taken it out of the map
+static byte *page_write(MemoryMap *map, DecodeCache *dc, int page) {
+    if (map->write[page]) return map->write[page];
+    if (map->clean[page]) return map->clean[page];
+    return dc ? dc->watched[page] : NULL;
+}
+
+//the first write to a clean page: mark it dirty, with the other pages
+//that write to the same host memory, and put their write pointers back
+//(unless the decode cache is watching them)
+static void mark_dirty(MemoryMap *map, DecodeCache *dc, int page) {
+    byte *host = map->clean[page];
+    for (int i = 0; i < 256; i++) {
+        if (map->clean[i] != host) continue;
+        map->dirty[i] = 1;
+        map->clean[i] = NULL;
+        if (!dc || !dc->watched[i]) map->write[i] = host;
+    }
+}
+
+//this takes the map and decode cache rather than the state, so runCPU's
+//local copy of the state doesn't have to be kept in memory for it
+static NOINLINE void write_slow(MemoryMap *map, DecodeCache *dc,
+                                uint16_t adr, byte val) {
+    if (map->clean[adr >> 8]) mark_dirty(map, dc, adr >> 8);
+    if (dc && dc->watched[adr >> 8]) {
+        dc->watched[adr >> 8][adr & 0xff] = val;
+        invalidate_code(map, dc, adr >> 8, adr & 0xff);
+    } else if (map->write[adr >> 8])
+        map->write[adr >> 8][adr & 0xff] = val;
+    else if (map->write_handler) map->write_handler(map->ctx, adr, val);
+}
+
+void trackDirtyPages(CPUState *cs) {
+    cs->map->track_dirty = 1;
+    clearDirtyPages(cs);
+}
+
+int getDirtyPages(CPUState *cs, byte *dirty) {
+    int n = 0;
+    for (int page = 0; page < 256; page++) {
+        dirty[page] = cs->map->dirty[page];
+        n += dirty[page];
     }
-    return r2;
+    clearDirtyPages(cs);
+    return n;
 }
 
-static uint8_t parity(byte b) {
-    // even bits set - parity 1,
-    // odd bits set - parity 0
-    int set = 0;
-    while (b > 0) {
-        set += b % 2;
-        b /= 2;
+//take the write pointer of each page with host memory to write to out
+//of the map, until the page is written to
+void clearDirtyPages(CPUState *cs) {
+    MemoryMap *map = cs->map;
+    for (int page = 0; page < 256; page++) {
+        byte *host = page_write(map, cs->decoded, page);
+        map->dirty[page] = 0;
+        if (!map->track_dirty || !host) continue;
+        map->clean[page] = host;
+        map->write[page] = NULL;
     }
-    return !(set % 2);
 }
 
-static void set_flags(uint16_t res, CPUState *state) {
-    state->fl.z = (res & 0xff) == 0; //zero
-    state->fl.s = (res & 0x80) != 0; //sign
-    state->fl.cy = res > 0xff; //carry (result > 255)
-    state->fl.p = parity(res & 0xff);
+static ALWAYS_INLINE byte read_byte(CPUState *state, uint16_t adr) {
+    byte *page = state->map->read[adr >> 8];
+    if (LIKELY(page != NULL)) return page[adr & 0xff];
+    return read_slow(state, adr);
+}
+
+static ALWAYS_INLINE void write_byte(CPUState *state, uint16_t adr, byte val) {
+    byte *page = state->map->write[adr >> 8];
+    if (LIKELY(page != NULL)) page[adr & 0xff] = val;
+    else write_slow(state->map, state->decoded, adr, val);
+}
+
+//the instruction at pc, read in place unless its operands could run
+//past the end of the page (or the page has no host memory), in which
+//case all three bytes it might use are copied into buf through the map.
+static ALWAYS_INLINE byte *fetch_op(CPUState *state, byte *buf) {
+    uint16_t pc = state->pc;
+    byte *page = state->map->read[pc >> 8];
+    if (LIKELY(page != NULL && (pc & 0xff) < PAGE_SIZE - 2))
+        return page + (pc & 0xff);
+    for (int i = 0; i < 3; i++) buf[i] = read_byte(state, pc + i);
+    return buf;
+}
+
+//the flag tables are indexed by bits 0-9 of the lazy flag word:
+//the result or PSW byte, carry, and whether it is a PSW byte.
+//psw_table gives the PSW byte for each (less aux carry, which is
+//kept separately), and cond_table the outcome of each of the eight
+//branch conditions, bit n for condition code n of the Jcc, Ccc and
+//Rcc opcodes (NZ, Z, NC, C, PO, PE, P, M). parity is set when an even
+//number of bits are set.
+#define PARITY(x) (!(((x) ^ (x) >> 1 ^ (x) >> 2 ^ (x) >> 3 ^ \
+                      (x) >> 4 ^ (x) >> 5 ^ (x) >> 6 ^ (x) >> 7) & 1))
+#define SZP_BITS(x) (((x) & 0x80) | ((x) == 0) << 6 | PARITY(x) << 2)
+#define LAZY_PSW(i) ((((i) & LF_PSW) ? (i) & 0xc4 : SZP_BITS((i) & 0xff)) | \
+                     0x02 | ((i) >> 8 & 1))
+#define PSW_CONDS(f) ((((f) & 0x40) == 0) | ((f) & 0x40) >> 5 | \
+                      (((f) & 0x01) == 0) << 2 | ((f) & 0x01) << 3 | \
+                      (((f) & 0x04) == 0) << 4 | ((f) & 0x04) << 3 | \
+                      (((f) & 0x80) == 0) << 6 | ((f) & 0x80))
+#define LAZY_CONDS(i) PSW_CONDS(LAZY_PSW(i))
+#define X4(m, i) m(i), m((i) + 1), m((i) + 2), m((i) + 3)
+#define X16(m, i) X4(m, i), X4(m, (i) + 4), X4(m, (i) + 8), X4(m, (i) + 12)
+#define X64(m, i) X16(m, i), X16(m, (i) + 16), X16(m, (i) + 32), X16(m, (i) + 48)
+#define X256(m, i) X64(m, i), X64(m, (i) + 64), X64(m, (i) + 128), X64(m, (i) + 192)
+#define X1024(m, i) X256(m, i), X256(m, (i) + 256), X256(m, (i) + 512), X256(m, (i) + 768)
+static const byte psw_table[0x400] = { X1024(LAZY_PSW, 0) };
+static const byte cond_table[0x400] = { X1024(LAZY_CONDS, 0) };
+
+//the bits of the lazy flag word that index the flag tables
+#define LF_INDEX(lf) ((lf) & 0x3ff)
+
+//work out the PSW byte from the lazy flag state
+static inline Flags flagsView(LazyFlags lf) {
+    Flags f;
+    f.psw = psw_table[LF_INDEX(lf)] | ((lf >> 16) & 0x10);
+    return f;
+}
+
+//lazy flag state for flags that were set directly
+static inline LazyFlags lazyFlags(Flags f) {
+    return LF_PSW | f.psw | (f.psw & 0x01) << 8 |
+           (LazyFlags) (f.psw & 0x10) << 16;
+}
+
+//record the flags for the 9-bit sum (or 8-bit logical result) res.
+//aux carry is bit 4 of aux: for a sum res = a + b (+ carry in), a ^ b
+//^ res has bit 4 set when there was a carry out of bit 3.
+static inline void set_flags(uint16_t res, byte aux, CPUState *state) {
+    state->lf = res | (LazyFlags) aux << 16;
 }
 
-static void set_result(uint16_t res, CPUState *state) {
+static inline void set_result(uint16_t res, byte aux, CPUState *state) {
     //set accumulator value and flags
-    set_flags(res, state);
-    state->reg[0] = res & 0xff; //res is always sent to A (the accumulator)
+    set_flags(res, aux, state);
+    state->a = res & 0xff; //res is always sent to A (the accumulator)
 }
 
-//for conditional jumps
-static int jump_if(int flag, uint16_t address, CPUState *s) {
-    if (!flag) {
-        return 0;
-    } else {
-        if (address >= s->mem_size) return 1;
-        s->pc = address;
-    }
-    return 0;
+//the carry flag, as 0 or 1
+#define CARRY (((state->lf) >> 8) & 1)
+
+//set carry, leaving the other flags alone
+static inline void set_carry(int cy, CPUState *state) {
+    state->lf = (state->lf & ~(LazyFlags) LF_CY) | (cy ? LF_CY : 0);
+}
+
+//accumulator arithmetic, shared by the register, memory and
+//immediate forms of each instruction
+static inline void alu_add(byte r2, CPUState *state) {
+    //avoid overflow with 16-bit precision
+    uint16_t res = state->a + r2;
+    set_result(res, state->a ^ r2 ^ res, state);
+}
+
+static inline void alu_adc(byte r2, CPUState *state) {
+    uint16_t res = state->a + r2 + CARRY;
+    set_result(res, state->a ^ r2 ^ res, state);
+}
+
+//subtraction adds the two's complement of the operand. the carry
+//flag works opposite to addition on 8080 (but not aux carry), which
+//flipping bit 8 of the sum takes care of.
+static inline void alu_sub(byte r2, CPUState *state) {
+    r2 = ~r2;
+    uint16_t res = state->a + r2 + 1;
+    set_result(res ^ 0x100, state->a ^ r2 ^ res, state);
 }
 
-typedef struct OpStats {
+static inline void alu_sbb(byte r2, CPUState *state) {
+    //from the 8080 programmers' manual:
+    //the carry is internally added to the
+    //second operand and subtraction then performed with normal
+    //two's complement rules.
+    r2 = ~r2;
+    uint16_t res = state->a + r2 + !CARRY;
+    set_result(res ^ 0x100, state->a ^ r2 ^ res, state);
+}
+
+static inline void alu_ana(byte r2, CPUState *state) {
+    //the behaviour of bitwise comparisons and the ac flag
+    //is poorly documented in the programmers' manual
+    set_result(state->a & r2, (state->a | r2) << 1, state);
+}
+
+static inline void alu_xra(byte r2, CPUState *state) {
+    set_result(state->a ^ r2, 0, state);
+}
+
+static inline void alu_ora(byte r2, CPUState *state) {
+    set_result(state->a | r2, 0, state);
+}
+
+static inline void alu_cmp(byte r2, CPUState *state) {
+    //CMP does not affect the accumulator.
+    //arg is subtracted from accumulator internally to
+    //set flags.
+    r2 = ~r2;
+    uint16_t res = state->a + r2 + 1;
+    set_flags(res ^ 0x100, state->a ^ r2 ^ res, state);
+}
+
+//INR and DCR do not affect carry. DCR adds 0xff, so it carries out
+//of bit 3 unless the low nibble was zero.
+static inline byte alu_inr(byte arg, CPUState *state) {
+    byte res = arg + 1;
+    set_flags(res | (state->lf & LF_CY), arg ^ res, state);
+    return res;
+}
+
+static inline byte alu_dcr(byte arg, CPUState *state) {
+    byte res = arg - 1;
+    set_flags(res | (state->lf & LF_CY), arg ^ res ^ 0x10, state);
+    return res;
+}
+
+//the bytes an instruction moved pc on by and the cycles it took
+struct OpStats {
     int opbytes, opcycles;
-} OpStats;
+};
 
 static OpStats executeOp(CPUState *state, byte *opcode);
 
-int stepCPU(CPUState *state) {
-    OpStats st = executeOp(state, &state->memory[state->pc]);
-    state->pc += st.opbytes;
-    return st.opcycles;
+/*
+    Instruction implementations. Every opcode has its own handler,
+    generated by the macros below, so the registers it operates on are
+    compile-time constants and nothing has to be decoded from the opcode
+    bits at runtime. Handlers only say how they finished (see OpEnd);
+    the length and cycle counts that go with that come from the opcode
+    table, which the callers have as constants too.
+
+    Each handler is built twice from its source: as name, for the plain
+    core, and as hooked_name, for the instrumented one (see setCPUHooks),
+    which tells the hooks about the memory it reads and writes. the body
+    takes which one it is as a constant, so neither build tests it.
+*/
+#define OP_HANDLER(name) \
+    static ALWAYS_INLINE OpEnd name##_body(CPUState *state, byte *opcode, \
+                                           const int hooked); \
+    static ALWAYS_INLINE OpEnd name(CPUState *state, byte *opcode) { \
+        return name##_body(state, opcode, 0); \
+    } \
+    static ALWAYS_INLINE OpEnd hooked_##name(CPUState *state, \
+                                             byte *opcode) { \
+        return name##_body(state, opcode, 1); \
+    } \
+    static ALWAYS_INLINE OpEnd name##_body(CPUState *state, byte *opcode, \
+                                           const int hooked)
+
+//fault checks, compiled in with CPU_CHECKS. a fault stops the
+//instruction before it changes anything, like HLT.
+#ifdef CPU_CHECKS
+#define TRAP_IF(cond, code) \
+    if (cond) { \
+        state->trap = (code); \
+        return OP_TRAPPED; \
+    }
+#else
+#define TRAP_IF(cond, code)
+#endif
+#ifdef CPU_BOARD
+#define MEM_SIZE BOARD_MEMORY
+#else
+#define MEM_SIZE state->mem_size
+#endif
+#define STACK_OVERFLOW_CHECK \
+    TRAP_IF(state->sp < 2, TRAP_STACK_OVERFLOW)
+#define STACK_UNDERFLOW_CHECK \
+    TRAP_IF(state->sp > MEM_SIZE - 2, TRAP_STACK_UNDERFLOW)
+#define ADDRESS_CHECK(adr, len) \
+    TRAP_IF((adr) > MEM_SIZE - (len), TRAP_BAD_ADDRESS)
+
+//memory through the hooks of the instrumented core
+static NOINLINE byte hooked_read(CPUState *state, uint16_t adr) {
+    byte val = read_byte(state, adr);
+    if (state->hooks->read) state->hooks->read(state->hooks->ctx, adr, val);
+    return val;
+}
+
+static NOINLINE void hooked_write(CPUState *state, uint16_t adr, byte val) {
+    write_byte(state, adr, val);
+    if (state->hooks->write) state->hooks->write(state->hooks->ctx, adr, val);
+}
+
+//memory through the map. addresses wrap around the address space.
+//the board's memory is the same in every BOARD_MEMORY bytes of it, and
+//nothing takes reads out of its map, so its reads skip the map.
+#ifdef CPU_BOARD
+#define PLAIN_READ(adr) (state->memory[(adr) & (BOARD_MEMORY - 1)])
+#else
+#define PLAIN_READ(adr) read_byte(state, (adr))
+#endif
+#define READ(adr) \
+    (hooked ? hooked_read(state, (adr)) : PLAIN_READ(adr))
+#define WRITE(adr, val) \
+    (hooked ? hooked_write(state, (adr), (val)) \
+            : write_byte(state, (adr), (val)))
+
+//registers and register pairs by name, and how to set each register.
+//M is the memory location addressed by the HL pair.
+#define REG_A state->a
+#define REG_B state->b
+#define REG_C state->c
+#define REG_D state->d
+#define REG_E state->e
+#define REG_H state->h
+#define REG_L state->l
+#define REG_M READ(state->hl)
+#define SET_A(val) (state->a = (val))
+#define SET_B(val) (state->b = (val))
+#define SET_C(val) (state->c = (val))
+#define SET_D(val) (state->d = (val))
+#define SET_E(val) (state->e = (val))
+#define SET_H(val) (state->h = (val))
+#define SET_L(val) (state->l = (val))
+#define SET_M(val) WRITE(state->hl, (val))
+#define PAIR_B state->bc
+#define PAIR_D state->de
+#define PAIR_H state->hl
+#define PAIR_SP state->sp
+
+//16-bit immediate operand
+#define IMM16 ((uint16_t) (opcode[2] << 8 | opcode[1]))
+
+//branch conditions, by the condition code in bits 3-5 of the opcode
+#define CC_NZ 0
+#define CC_Z 1
+#define CC_NC 2
+#define CC_C 3
+#define CC_PO 4
+#define CC_PE 5
+#define CC_P 6
+#define CC_M 7
+#define COND(cc) ((cond_table[LF_INDEX(state->lf)] >> CC_##cc) & 1)
+
+//nops (including the undocumented opcodes)
+OP_HANDLER(op_nop) {
+    return OP_NEXT;
+}
+
+//STC
+OP_HANDLER(op_stc) {
+    state->lf |= LF_CY;
+    return OP_NEXT;
+}
+
+//CMC
+OP_HANDLER(op_cmc) {
+    state->lf ^= LF_CY;
+    return OP_NEXT;
+}
+
+//INR, DCR
+#define INR(r) OP_HANDLER(op_inr_##r) { \
+    SET_##r(alu_inr(REG_##r, state)); \
+    return OP_NEXT; \
+}
+#define DCR(r) OP_HANDLER(op_dcr_##r) { \
+    SET_##r(alu_dcr(REG_##r, state)); \
+    return OP_NEXT; \
+}
+INR(B) INR(C) INR(D) INR(E)
+INR(H) INR(L) INR(M) INR(A)
+DCR(B) DCR(C) DCR(D) DCR(E)
+DCR(H) DCR(L) DCR(M) DCR(A)
+
+//DAA
+OP_HANDLER(op_daa) {
+    uint16_t acc = state->a;
+    //need to preserve carry if already set
+    int cflag = CARRY;
+    byte aux = state->lf >> 16;
+    if ((acc & 0x0f) > 0x9 || (aux & 0x10)) {
+        if ((acc & 0x0f) > 0x09) aux = 0x10;
+        else aux = 0;
+        acc += 0x06;
+    }
+    if (acc >= 0xa0 || CARRY) {
+        acc += 0x60;
+        cflag = 1;
+    }
+    set_result((acc & 0xff) | cflag << 8, aux, state);
+    return OP_NEXT;
+}
+
+//CMA
+OP_HANDLER(op_cma) {
+    state->a = ~state->a;
+    return OP_NEXT;
+}
+
+//MOV
+#define MOV(dst, src) OP_HANDLER(op_mov_##dst##_##src) { \
+    SET_##dst(REG_##src); \
+    return OP_NEXT; \
+}
+MOV(B, B) MOV(B, C) MOV(B, D) MOV(B, E)
+MOV(B, H) MOV(B, L) MOV(B, M) MOV(B, A)
+MOV(C, B) MOV(C, C) MOV(C, D) MOV(C, E)
+MOV(C, H) MOV(C, L) MOV(C, M) MOV(C, A)
+MOV(D, B) MOV(D, C) MOV(D, D) MOV(D, E)
+MOV(D, H) MOV(D, L) MOV(D, M) MOV(D, A)
+MOV(E, B) MOV(E, C) MOV(E, D) MOV(E, E)
+MOV(E, H) MOV(E, L) MOV(E, M) MOV(E, A)
+MOV(H, B) MOV(H, C) MOV(H, D) MOV(H, E)
+MOV(H, H) MOV(H, L) MOV(H, M) MOV(H, A)
+MOV(L, B) MOV(L, C) MOV(L, D) MOV(L, E)
+MOV(L, H) MOV(L, L) MOV(L, M) MOV(L, A)
+MOV(M, B) MOV(M, C) MOV(M, D) MOV(M, E)
+MOV(M, H) MOV(M, L)           MOV(M, A)
+MOV(A, B) MOV(A, C) MOV(A, D) MOV(A, E)
+MOV(A, H) MOV(A, L) MOV(A, M) MOV(A, A)
+
+//STAX, LDAX
+#define STAX(rp) OP_HANDLER(op_stax_##rp) { \
+    WRITE(PAIR_##rp, state->a); \
+    return OP_NEXT; \
+}
+#define LDAX(rp) OP_HANDLER(op_ldax_##rp) { \
+    state->a = READ(PAIR_##rp); \
+    return OP_NEXT; \
+}
+STAX(B) STAX(D)
+LDAX(B) LDAX(D)
+
+//ADD, ADC, SUB, SBB, ANA, XRA, ORA, CMP
+#define ALU(op, r) OP_HANDLER(op_##op##_##r) { \
+    alu_##op(REG_##r, state); \
+    return OP_NEXT; \
+}
+#define ALU_ALL(op) \
+    ALU(op, B) ALU(op, C) ALU(op, D) ALU(op, E) \
+    ALU(op, H) ALU(op, L) ALU(op, M) ALU(op, A)
+ALU_ALL(add) ALU_ALL(adc) ALU_ALL(sub) ALU_ALL(sbb)
+ALU_ALL(ana) ALU_ALL(xra) ALU_ALL(ora) ALU_ALL(cmp)
+
+//ADI, ACI, SUI, SBI, ANI, XRI, ORI, CPI
+#define ALU_IMM(op) OP_HANDLER(op_##op##_imm) { \
+    alu_##op(opcode[1], state); \
+    return OP_NEXT; \
+}
+ALU_IMM(add) ALU_IMM(adc) ALU_IMM(sub) ALU_IMM(sbb)
+ALU_IMM(ana) ALU_IMM(xra) ALU_IMM(ora) ALU_IMM(cmp)
+
+//the same arithmetic, and INR and DCR, leaving the flags alone. these
+//are for threaded blocks, which use them where nothing reads the flags
+//an instruction sets before they are set again (see flags_live). CMP
+//still reads its operand, which could be an I/O handler.
+static inline void alu_add_nf(byte r2, CPUState *state) {
+    state->a += r2;
+}
+
+static inline void alu_adc_nf(byte r2, CPUState *state) {
+    state->a += r2 + CARRY;
+}
+
+static inline void alu_sub_nf(byte r2, CPUState *state) {
+    state->a -= r2;
+}
+
+static inline void alu_sbb_nf(byte r2, CPUState *state) {
+    state->a -= r2 + CARRY;
+}
+
+static inline void alu_ana_nf(byte r2, CPUState *state) {
+    state->a &= r2;
+}
+
+static inline void alu_xra_nf(byte r2, CPUState *state) {
+    state->a ^= r2;
+}
+
+static inline void alu_ora_nf(byte r2, CPUState *state) {
+    state->a |= r2;
 }
 
-int interruptCPU(CPUState *state, byte opcode) {
-    //this only supports an RST instruction
-    if (state->int_enable) {
-        int rst_adr = opcode - 0xc7;
-        state->sp -= 2;
-        state->memory[state->sp] = state->pc & 0xff;
-        state->memory[state->sp+1] = state->pc >> 8;
-        state->pc = rst_adr;
-        return 11;
-    } else return 0;
+static inline void alu_cmp_nf(byte r2, CPUState *state) {
+    (void) r2;
+    (void) state;
 }
 
-//instruction implementations
-//returns number of cycles for instruction - 0 for halt
+#define ALU_NF(op, r) OP_HANDLER(op_##op##_##r##_nf) { \
+    alu_##op##_nf(REG_##r, state); \
+    return OP_NEXT; \
+}
+#define ALU_NF_ALL(op) \
+    ALU_NF(op, B) ALU_NF(op, C) ALU_NF(op, D) ALU_NF(op, E) \
+    ALU_NF(op, H) ALU_NF(op, L) ALU_NF(op, M) ALU_NF(op, A) \
+    OP_HANDLER(op_##op##_imm_nf) { \
+        alu_##op##_nf(opcode[1], state); \
+        return OP_NEXT; \
+    }
+ALU_NF_ALL(add) ALU_NF_ALL(adc) ALU_NF_ALL(sub) ALU_NF_ALL(sbb)
+ALU_NF_ALL(ana) ALU_NF_ALL(xra) ALU_NF_ALL(ora) ALU_NF_ALL(cmp)
+
+#define INR_NF(r) OP_HANDLER(op_inr_##r##_nf) { \
+    SET_##r(REG_##r + 1); \
+    return OP_NEXT; \
+}
+#define DCR_NF(r) OP_HANDLER(op_dcr_##r##_nf) { \
+    SET_##r(REG_##r - 1); \
+    return OP_NEXT; \
+}
+INR_NF(B) INR_NF(C) INR_NF(D) INR_NF(E)
+INR_NF(H) INR_NF(L) INR_NF(M) INR_NF(A)
+DCR_NF(B) DCR_NF(C) DCR_NF(D) DCR_NF(E)
+DCR_NF(H) DCR_NF(L) DCR_NF(M) DCR_NF(A)
+
+//RLC
+OP_HANDLER(op_rlc) {
+    int cy = state->a >= 0x80;
+    set_carry(cy, state);
+    state->a <<= 1;
+    state->a += cy;
+    return OP_NEXT;
+}
+
+//RRC
+OP_HANDLER(op_rrc) {
+    int cy = state->a & 0x01;
+    set_carry(cy, state);
+    state->a >>= 1;
+    state->a += cy * 0x80;
+    return OP_NEXT;
+}
+
+//RAL
+OP_HANDLER(op_ral) {
+    int tmp = CARRY;
+    set_carry(state->a >= 0x80, state);
+    state->a <<= 1;
+    state->a += tmp;
+    return OP_NEXT;
+}
+
+//RAR
+OP_HANDLER(op_rar) {
+    int tmp = CARRY;
+    set_carry(state->a & 0x01, state);
+    state->a >>= 1;
+    state->a += tmp * 0x80;
+    return OP_NEXT;
+}
+
+//PUSH
+#define PUSH(hi, lo) OP_HANDLER(op_push_##hi) { \
+    STACK_OVERFLOW_CHECK \
+    state->sp -= 2; \
+    WRITE(state->sp + 1, REG_##hi); \
+    WRITE(state->sp, REG_##lo); \
+    return OP_NEXT; \
+}
+PUSH(B, C) PUSH(D, E) PUSH(H, L)
+
+//PUSH PSW
+OP_HANDLER(op_push_psw) {
+    STACK_OVERFLOW_CHECK
+    state->sp -= 2;
+    WRITE(state->sp + 1, state->a);
+    WRITE(state->sp, flagsView(state->lf).psw);
+    return OP_NEXT;
+}
+
+//POP
+#define POP(hi, lo) OP_HANDLER(op_pop_##hi) { \
+    STACK_UNDERFLOW_CHECK \
+    REG_##hi = READ(state->sp + 1); \
+    REG_##lo = READ(state->sp); \
+    state->sp += 2; \
+    return OP_NEXT; \
+}
+POP(B, C) POP(D, E) POP(H, L)
+
+//POP PSW
+OP_HANDLER(op_pop_psw) {
+    STACK_UNDERFLOW_CHECK
+    state->lf = lazyFlags((Flags) {READ(state->sp)});
+    state->a = READ(state->sp + 1);
+    state->sp += 2;
+    return OP_NEXT;
+}
+
+//DAD
+#define DAD(rp) OP_HANDLER(op_dad_##rp) { \
+    uint32_t res = (uint32_t) state->hl + PAIR_##rp; \
+    set_carry(res > 0xffff, state); \
+    state->hl = res; \
+    return OP_NEXT; \
+}
+DAD(B) DAD(D) DAD(H) DAD(SP)
+
+//INX, DCX
+#define INX(rp) OP_HANDLER(op_inx_##rp) { \
+    PAIR_##rp += 1; \
+    return OP_NEXT; \
+}
+#define DCX(rp) OP_HANDLER(op_dcx_##rp) { \
+    PAIR_##rp -= 1; \
+    return OP_NEXT; \
+}
+INX(B) INX(D) INX(H) INX(SP)
+DCX(B) DCX(D) DCX(H) DCX(SP)
+
+//XCHG
+OP_HANDLER(op_xchg) {
+    uint16_t tmp = state->hl;
+    state->hl = state->de;
+    state->de = tmp;
+    return OP_NEXT;
+}
+
+//XTHL
+OP_HANDLER(op_xthl) {
+    STACK_UNDERFLOW_CHECK
+    uint16_t tmp = state->hl;
+    state->l = READ(state->sp);
+    state->h = READ(state->sp + 1);
+    WRITE(state->sp, tmp & 0xff);
+    WRITE(state->sp + 1, tmp >> 8);
+    return OP_NEXT;
+}
+
+//SPHL
+OP_HANDLER(op_sphl) {
+    state->sp = state->hl;
+    return OP_NEXT;
+}
+
+//LXI
+#define LXI(rp) OP_HANDLER(op_lxi_##rp) { \
+    PAIR_##rp = IMM16; \
+    return OP_NEXT; \
+}
+LXI(B) LXI(D) LXI(H) LXI(SP)
+
+//MVI
+#define MVI(r) OP_HANDLER(op_mvi_##r) { \
+    SET_##r(opcode[1]); \
+    return OP_NEXT; \
+}
+MVI(B) MVI(C) MVI(D) MVI(E)
+MVI(H) MVI(L) MVI(M) MVI(A)
+
+//STA
+OP_HANDLER(op_sta) {
+    uint16_t mem_adr = IMM16;
+    ADDRESS_CHECK(mem_adr, 1)
+    WRITE(mem_adr, state->a);
+    return OP_NEXT;
+}
+
+//LDA
+OP_HANDLER(op_lda) {
+    uint16_t mem_adr = IMM16;
+    ADDRESS_CHECK(mem_adr, 1)
+    state->a = READ(mem_adr);
+    return OP_NEXT;
+}
+
+//SHLD
+OP_HANDLER(op_shld) {
+    uint16_t mem_adr = IMM16;
+    ADDRESS_CHECK(mem_adr, 2)
+    WRITE(mem_adr, state->l);
+    WRITE(mem_adr + 1, state->h);
+    return OP_NEXT;
+}
+
+//LHLD
+OP_HANDLER(op_lhld) {
+    uint16_t mem_adr = IMM16;
+    ADDRESS_CHECK(mem_adr, 2)
+    state->l = READ(mem_adr);
+    state->h = READ(mem_adr + 1);
+    return OP_NEXT;
+}
+
+//PCHL
+OP_HANDLER(op_pchl) {
+    ADDRESS_CHECK(state->hl, 1)
+    state->pc = state->hl;
+    return OP_TAKEN;
+}
+
+//JMP
+OP_HANDLER(op_jmp) {
+    ADDRESS_CHECK(IMM16, 1)
+    state->pc = IMM16;
+    return OP_TAKEN;
+}
+
+//JNZ, JZ, JNC, JC, JPO, JPE, JP, JM
+#define JCC(cc) OP_HANDLER(op_j##cc) { \
+    if (!COND(cc)) return OP_NEXT; \
+    ADDRESS_CHECK(IMM16, 1) \
+    state->pc = IMM16; \
+    return OP_TAKEN; \
+}
+JCC(NZ) JCC(Z) JCC(NC) JCC(C) JCC(PO) JCC(PE) JCC(P) JCC(M)
+
+//JNZ, JZ, JNC and JC for runCPU's superinstructions (FUSED_TABLE),
+//which only run them straight after an instruction that set the flags
+//from a result, so they can test the result instead of the table
+#define RESULT_NZ ((state->lf & 0xff) != 0)
+#define RESULT_Z ((state->lf & 0xff) == 0)
+#define RESULT_NC (!CARRY)
+#define RESULT_C CARRY
+#define JCC_RESULT(cc) OP_HANDLER(op_j##cc##_result) { \
+    if (!RESULT_##cc) return OP_NEXT; \
+    ADDRESS_CHECK(IMM16, 1) \
+    state->pc = IMM16; \
+    return OP_TAKEN; \
+}
+JCC_RESULT(NZ) JCC_RESULT(Z) JCC_RESULT(NC) JCC_RESULT(C)
+
+//push return address to stack
+static ALWAYS_INLINE void call_push(uint16_t ret_adr, CPUState *state,
+                                     const int hooked) {
+    state->sp -= 2;
+    WRITE(state->sp + 1, ret_adr >> 8);
+    WRITE(state->sp, ret_adr & 0xff);
+}
+
+//CALL. the address is read before the push, which could overwrite it
+OP_HANDLER(op_call) {
+    uint16_t call_adr = IMM16;
+    STACK_OVERFLOW_CHECK
+    ADDRESS_CHECK(call_adr, 1)
+    call_push(state->pc + 3, state, hooked);
+    state->pc = call_adr;
+    return OP_TAKEN;
+}
+
+//CNZ, CZ, CNC, CC, CPO, CPE, CP, CM
+#define CCC(cc) OP_HANDLER(op_c##cc) { \
+    if (!COND(cc)) return OP_NEXT; \
+    uint16_t call_adr = IMM16; \
+    STACK_OVERFLOW_CHECK \
+    ADDRESS_CHECK(call_adr, 1) \
+    call_push(state->pc + 3, state, hooked); \
+    state->pc = call_adr; \
+    return OP_TAKEN; \
+}
+CCC(NZ) CCC(Z) CCC(NC) CCC(C) CCC(PO) CCC(PE) CCC(P) CCC(M)
+
+//return address on top of the stack
+#define RET_ADR ((uint16_t) (READ(state->sp + 1) << 8 | READ(state->sp)))
+
+//RET
+OP_HANDLER(op_ret) {
+    STACK_UNDERFLOW_CHECK
+    ADDRESS_CHECK(RET_ADR, 1)
+    state->pc = RET_ADR;
+    state->sp += 2;
+    return OP_TAKEN;
+}
+
+//RNZ, RZ, RNC, RC, RPO, RPE, RP, RM
+#define RCC(cc) OP_HANDLER(op_r##cc) { \
+    if (!COND(cc)) return OP_NEXT; \
+    STACK_UNDERFLOW_CHECK \
+    ADDRESS_CHECK(RET_ADR, 1) \
+    state->pc = RET_ADR; \
+    state->sp += 2; \
+    return OP_TAKEN; \
+}
+RCC(NZ) RCC(Z) RCC(NC) RCC(C) RCC(PO) RCC(PE) RCC(P) RCC(M)
+
+//RST 0-7
+//push return address onto stack and jump to
+//specified ISR
+#define RST(n) OP_HANDLER(op_rst_##n) { \
+    STACK_OVERFLOW_CHECK \
+    call_push(state->pc + 1, state, hooked); \
+    state->pc = 8 * (n); \
+    return OP_TAKEN; \
+}
+RST(0) RST(1) RST(2) RST(3) RST(4) RST(5) RST(6) RST(7)
+
+//EI, DI
+OP_HANDLER(op_ei) {
+    state->int_enable = 1;
+    return OP_NEXT;
+}
+OP_HANDLER(op_di) {
+    state->int_enable = 0;
+    return OP_NEXT;
+}
+
+//the board's ports run in place, and the rest as below
+#ifdef CPU_BOARD
+#define BOARD_IN(n, expr) \
+    case n: \
+        state->a = (expr); \
+        return OP_NEXT;
+#define BOARD_OUT(n, action) \
+    case n: \
+        action; \
+        return OP_NEXT;
+#define BOARD_PORTS(ports, handler) \
+    Machine *m = state->host; \
+    switch (port) { \
+        ports(handler) \
+    }
+#else
+#define BOARD_PORTS(ports, handler)
+#endif
+
+//IN
+OP_HANDLER(op_in) {
+    byte port = opcode[1];
+    BOARD_PORTS(BOARD_IN_PORTS, BOARD_IN)
+    PortInHandler in = state->map->in[port];
+    state->a = in ? in(state->map->ctx, port) : state->ports[port];
+    return OP_NEXT;
+}
+
+//OUT. a port without a handler latches the byte, and runCPU stops
+//after it for the host to service (see OUT_STOPS)
+OP_HANDLER(op_out) {
+    byte port = opcode[1];
+    byte val = state->a;
+    BOARD_PORTS(BOARD_OUT_PORTS, BOARD_OUT)
+    PortOutHandler out = state->map->out[port];
+    if (out) out(state->map->ctx, port, val);
+    else {
+        state->ports[port] = val;
+        state->write_flag = port;
+    }
+    return OP_NEXT;
+}
+
+//whether opcode code, with stop from the opcode table, hands control
+//back to the host after it has run: OUT only does if it set write_flag
+#define OUT_STOPS(code, stop) \
+    ((stop) && ((code) != 0xd3 || state->write_flag >= 0))
+
+//HLT (pc stays on it while the CPU is halted)
+OP_HANDLER(op_hlt) {
+    state->halted = 1;
+    return OP_TAKEN;
+}
+
+//an interrupt, on either core. this only supports an RST instruction
+static ALWAYS_INLINE int interrupt(CPUState *state, byte opcode,
+                                   const int hooked) {
+    if (!state->int_enable) return 0;
+    int rst_adr = opcode - 0xc7;
+    //a halted CPU returns to the instruction after the HLT
+    if (state->halted) state->pc++;
+    state->halted = 0;
+    state->sp -= 2;
+    WRITE(state->sp, state->pc & 0xff);
+    WRITE(state->sp + 1, state->pc >> 8);
+    if (hooked && state->hooks->branch)
+        state->hooks->branch(state->hooks->ctx, state->pc, rst_adr);
+    state->pc = rst_adr;
+    return 11;
+}
+
+#define TABLE_ENTRY(code, handler, ...) [code] = handler,
+#define LEN_ENTRY(code, handler, len, ...) [code] = len,
+#define CYCLES_ENTRY(code, handler, len, cycles, ...) [code] = cycles,
+#define TAKEN_ENTRY(code, handler, len, cycles, taken, ...) [code] = taken,
+#define FLAGS_READ_ENTRY(code, handler, len, cycles, taken, stop, \
+                         mnemonic, operands, format, read, written) \
+    [code] = read,
+#define FLAGS_WRITTEN_ENTRY(code, handler, len, cycles, taken, stop, \
+                            mnemonic, operands, format, read, written) \
+    [code] = written,
+static const OpHandler handler_table[256] = {
+    OPCODE_TABLE(TABLE_ENTRY)
+};
+static const byte oplen[256] = { OPCODE_TABLE(LEN_ENTRY) };
+static const byte opcycles[256] = { OPCODE_TABLE(CYCLES_ENTRY) };
+static const byte optaken[256] = { OPCODE_TABLE(TAKEN_ENTRY) };
+static const byte flags_read[256] = { OPCODE_TABLE(FLAGS_READ_ENTRY) };
+static const byte flags_written[256] = { OPCODE_TABLE(FLAGS_WRITTEN_ENTRY) };
+
+//the bytes and cycles an instruction of length len, taking cycles
+//cycles (or taken if it branches), took when it ended as end says
+static ALWAYS_INLINE OpStats op_stats(OpEnd end, int len, int cycles,
+                                      int taken) {
+    if (end == OP_NEXT) return (OpStats) {len, cycles};
+    return (OpStats) {0, end == OP_TAKEN ? taken : 0};
+}
+
+//the same for opcode code, from the opcode table
+static ALWAYS_INLINE OpStats table_stats(byte code, OpEnd end) {
+    return op_stats(end, oplen[code], opcycles[code], optaken[code]);
+}
+
+//each handler with its opcode's length and cycles built in, which keeps
+//looking them up off the path from one instruction's pc to the next
+#define STEP_FUNCTION(code, handler, len, cycles, taken, ...) \
+    static OpStats step_##code(CPUState *state, byte *opcode) { \
+        return op_stats(handler(state, opcode), len, cycles, taken); \
+    }
+#define STEP_ENTRY(code, ...) [code] = step_##code,
+OPCODE_TABLE(STEP_FUNCTION)
+static const OpStep optable[256] = {
+    OPCODE_TABLE(STEP_ENTRY)
+};
+
+//decode and execute a single instruction
 static OpStats executeOp(CPUState *state, byte *opcode) {
     state->write_flag = -1;
-    OpStats st;
-    st.opcycles = 0;
-    st.opbytes = 1;
-    switch (*opcode) {
-        //nops
-        case 0x00: case 0x08: case 0x10: case 0x18:
-        case 0x20: case 0x28: case 0x30: case 0x38:
-        case 0xcb: case 0xd9: case 0xdd: case 0xed:
-        case 0xfd:
-        {
-            st.opcycles = 4; break;
-        }
-        //STC
-        case 0x37:
-        {
-            st.opcycles = 4; state->fl.cy = 1; break;
-        }
-        //CMC
-        case 0x3f:
-        {
-            st.opcycles = 4; state->fl.cy = !state->fl.cy; break;
+    return optable[*opcode](state, opcode);
+}
+
+/*
+    Decode cache. Instructions are decoded the first time they run from
+    a page with host memory behind it, into a table for that page. To
+    see guest writes that change a decoded instruction, every page that
+    writes to the same host memory as a page with decoded instructions
+    (including mirrors of it) has its write pointer taken out of the
+    map, so its writes go through write_slow.
+*/
+static void free_dead_blocks(DecodeCache *dc) {
+    while (dc->dead) {
+        Block *b = dc->dead;
+        dc->dead = b->next;
+        free(b);
+    }
+}
+
+//drop the translated code made from a page's instructions
+static void drop_translated(DecodeCache *dc, int page) {
+    DecodedOp *ops = dc->ops[page];
+    for (int k = 0; k < PAGE_SIZE; k++) {
+        if (ops[k].block) {
+            ops[k].block->next = dc->dead;
+            dc->dead = ops[k].block;
+            ops[k].block = NULL;
         }
-        //INR
-        case 0x04: case 0x0c: case 0x14: case 0x1c:
-        case 0x24: case 0x2c: case 0x34: case 0x3c:
-        {
-            st.opcycles = 5;
-            int atype = (*opcode - 0x04) / 8;
-            byte res;
-            int ri = -1;
-            uint16_t mem_adr = 0;
-            if (atype < 6) {
-                ri = atype + 1;
-                res = state->reg[ri];
-            } else if (atype == 7) {
-                ri = 0;
-                res = state->reg[ri];
-            } else {
-                st.opcycles = 10;
-                mem_adr = state->reg[5] << 8 | state->reg[6];
-                res = state->memory[mem_adr];
-            }
-            state->fl.ac = (res & 0x0f) == 0x0f;
-            res++;
-            //INR does not affect carry.
-            byte cy_old = state->fl.cy;
-            set_flags(res, state);
-            state->fl.cy = cy_old;
-            if (ri < 0) {
-                state->memory[mem_adr] = res;
-            } else {
-                state->reg[ri] = res;
-            }
-            break;
+        ops[k].in_block = 0;
+    }
+#ifdef JIT_X86_64
+    if (dc->jit) jit_drop_page(dc->jit, page);
+#endif
+    dc->dropped = 1;
+}
+
+void enableDecodeCache(CPUState *cs) {
+    if (cs->decoded) return;
+    cs->decoded = calloc(1, sizeof(DecodeCache));
+}
+
+void flushDecodeCache(CPUState *cs) {
+    DecodeCache *dc = cs->decoded;
+    if (!dc) return;
+#ifdef JIT_X86_64
+    if (dc->jit) jit_flush(dc->jit, dc);
+#endif
+    for (int i = 0; i < dc->ncode; i++) {
+        int page = dc->code_pages[i];
+        DecodedOp *ops = dc->ops[page];
+        dc->ops[page] = NULL;
+        if (dc->shared_hits[page]) {
+            free(dc->shared_hits[page]);
+            dc->shared_hits[page] = NULL;
+            continue;
         }
-        //DCR
-        case 0x05: case 0x0d: case 0x15: case 0x1d:
-        case 0x25: case 0x2d: case 0x35: case 0x3d:
-        {
-            st.opcycles = 5;
-            int atype = (*opcode - 0x05) / 8;
-            byte res;
-            int ri = -1;
-            uint16_t mem_adr = 0;
-            if (atype < 6) {
-                ri = atype + 1;
-                res = state->reg[ri];
-            } else if (atype == 7) {
-                ri = 0;
-                res = state->reg[ri];
-            } else {
-                st.opcycles = 10;
-                mem_adr = state->reg[5] << 8 | state->reg[6];
-                res = state->memory[mem_adr];
-            }
-            state->fl.ac = (res & 0x0f) != 0x00;
-            res--;
-            byte cy_old = state->fl.cy;
-            set_flags(res, state);
-            state->fl.cy = cy_old;
-            if (ri < 0) {
-                state->memory[mem_adr] = res;
-            } else {
-                state->reg[ri] = res;
-            }
-            break;
+        for (int k = 0; k < PAGE_SIZE; k++) free(ops[k].block);
+        free(ops);
+    }
+    dc->ncode = 0;
+    free_dead_blocks(dc);
+    dc->aliased = 0;
+    for (int page = 0; page < 256; page++) {
+        if (dc->watched[page] && !cs->map->clean[page])
+            cs->map->write[page] = dc->watched[page];
+        dc->watched[page] = NULL;
+        dc->code_watched[page] = 0;
+    }
+}
+
+SharedCode *newSharedCode(void) {
+    SharedCode *sc = calloc(1, sizeof(SharedCode));
+    atomic_init(&sc->refs, 1);
+    return sc;
+}
+
+void releaseSharedCode(SharedCode *sc) {
+    if (!sc || atomic_fetch_sub(&sc->refs, 1) != 1) return;
+    for (int page = 0; page < 256; page++) {
+        SharedPage *p = atomic_load(&sc->pages[page]);
+        while (p) {
+            SharedPage *next = p->next;
+            for (int k = 0; k < PAGE_SIZE; k++) free(p->ops[k].block);
+            free(p);
+            p = next;
         }
-        //DAA
-        case 0x27:
-        {
-            st.opcycles = 4;
-            uint16_t acc = state->reg[0];
-            //need to preserve carry if already set
-            int cflag = state->fl.cy;
-            if ((acc & 0x0f) > 0x9 || state->fl.ac) {
-                if ((acc & 0x0f) > 0x09) state->fl.ac = 1;
-                else state->fl.ac = 0;
-                acc += 0x06;
-            }
-            if (acc >= 0xa0 || state->fl.cy) {
-                acc += 0x60;
-                cflag = 1;
-            }
-            set_result(acc, state);
-            state->fl.cy = cflag;
-            break;
+    }
+    free(sc);
+}
+
+void shareDecodeCache(CPUState *cs, SharedCode *sc) {
+    enableDecodeCache(cs);
+    //pages decoded already are decoded again, from the shared code if
+    //they can be
+    flushDecodeCache(cs);
+    atomic_fetch_add(&sc->refs, 1);
+    releaseSharedCode(cs->decoded->shared);
+    cs->decoded->shared = sc;
+}
+
+//watch every page that writes to the host memory code page reads from
+static void watch_code_page(CPUState *state, int code) {
+    DecodeCache *dc = state->decoded;
+    byte *host = state->map->read[code];
+    if (dc->code_watched[code]) return;
+    dc->code_watched[code] = 1;
+    for (int page = 0; page < 256; page++) {
+        if (page_write(state->map, dc, page) == host) {
+            dc->watched[page] = host;
+            state->map->write[page] = NULL;
+            if (page != code) dc->aliased = 1;
         }
-        //CMA
-        case 0x2f:
-        {
-            st.opcycles = 4;
-            state->reg[0] = ~state->reg[0];
-            break;
-        }
-        //MOV
-        case 0x40: case 0x41: case 0x42: case 0x43:
-        case 0x44: case 0x45: case 0x46: case 0x47:
-        case 0x48: case 0x49: case 0x4a: case 0x4b:
-        case 0x4c: case 0x4d: case 0x4e: case 0x4f:
-        case 0x50: case 0x51: case 0x52: case 0x53:
-        case 0x54: case 0x55: case 0x56: case 0x57:
-        case 0x58: case 0x59: case 0x5a: case 0x5b:
-        case 0x5c: case 0x5d: case 0x5e: case 0x5f:
-        case 0x60: case 0x61: case 0x62: case 0x63:
-        case 0x64: case 0x65: case 0x66: case 0x67:
-        case 0x68: case 0x69: case 0x6a: case 0x6b:
-        case 0x6c: case 0x6d: case 0x6e: case 0x6f:
-        case 0x70: case 0x71: case 0x72: case 0x73:
-        case 0x74: case 0x75: case 0x77:
-        case 0x78: case 0x79: case 0x7a: case 0x7b:
-        case 0x7c: case 0x7d: case 0x7e: case 0x7f:
-        {
-            st.opcycles = 5;
-            int srctype = *opcode & 0x07;
-            if (srctype == 6) st.opcycles = 7;
-            byte data = arithmeticOperand(srctype, state);
-            int dsttype = (*opcode & 0x38) / 8;
-            if (dsttype < 6) {
-                state->reg[dsttype + 1] = data;
-            } else if (dsttype == 7) {
-                state->reg[0] = data;
-            } else {
-                st.opcycles = 7;
-                int mem_adr = state->reg[5] << 8 | state->reg[6];
-                state->memory[mem_adr] = data;
-            }
-            break;
-        }
-        //STAX
-        case 0x02: case 0x12:
-        {
-            st.opcycles = 7;
-            int base_reg = 1 + 2 * (*opcode == 0x12);
-            int mem_adr = state->reg[base_reg] << 8 | state->reg[base_reg + 1];
-            state->memory[mem_adr] = state->reg[0];
-            break;
-        }
-        //LDAX
-        case 0x0A: case 0x1A:
-        {
-            st.opcycles = 7;
-            int base_reg = 1 + 2 * (*opcode == 0x1A);
-            int mem_adr = state->reg[base_reg] << 8 | state->reg[base_reg + 1];
-            state->reg[0] = state->memory[mem_adr];
-            break;
-        }
-        //ADD, ADI
-        case 0x80: case 0x81: case 0x82: case 0x83:
-        case 0x84: case 0x85: case 0x86: case 0x87:
-        case 0xc6:
-        {
-            if (*opcode == 0xc6 || *opcode == 0x86) st.opcycles = 7;
-            else st.opcycles = 4;
-            byte r2;
-            //immediate
-            if (*opcode == 0xc6) {
-                r2 = opcode[1]; st.opbytes = 2;
-            } else {
-                //registers are just an array of bytes
-                r2 = arithmeticOperand(*opcode - 0x80, state);
-            }
-            //avoid overflow with 16-bit precision
-            uint16_t res = state->reg[0] + r2;
-            //set aux carry
-            state->fl.ac = (state->reg[0] & 0x0f) + (r2 & 0x0f) > 0x0f;
-            set_result(res, state);
-            break;
-        }
-        //ADC, ACI
-        case 0x88: case 0x89: case 0x8a: case 0x8b:
-        case 0x8c: case 0x8d: case 0x8e: case 0x8f:
-        case 0xce:
-        {
-            if (*opcode == 0xce || *opcode == 0x8e) st.opcycles = 7;
-            else st.opcycles = 4;
-            byte r2;
-            //immediate
-            if (*opcode == 0xce) {
-                r2 = opcode[1]; st.opbytes = 2;
-            } else {
-                r2 = arithmeticOperand(*opcode - 0x88, state);
-            }
-            uint16_t res = state->reg[0] + r2 + state->fl.cy;
-            state->fl.ac = (state->reg[0] & 0x0f) + (r2 & 0x0f) + state->fl.cy > 0x0f;
-            set_result(res, state);
-            break;
-        }
-        //SUB, SUI
-        case 0x90: case 0x91: case 0x92: case 0x93:
-        case 0x94: case 0x95: case 0x96: case 0x97:
-        case 0xd6:
-        {
-            if (*opcode == 0xd6 || *opcode == 0x96) st.opcycles = 7;
-            else st.opcycles = 4;
-            byte r2;
-            if (*opcode == 0xd6) {
-                r2 = ~opcode[1]; st.opbytes = 2;
-            } else {
-                r2 = ~arithmeticOperand(*opcode - 0x90, state);
-            }
-            uint16_t res = state->reg[0] + r2 + 1;
-            state->fl.ac = (state->reg[0] & 0x0f) + (r2 & 0x0f) + 1 > 0x0f;
-            set_result(res, state);
-            //carry flag works opposite to addition on 8080 (but not aux carry)
-            state->fl.cy = !state->fl.cy;
-            break;
-        }
-        //SBB, SBI
-        case 0x98: case 0x99: case 0x9a: case 0x9b:
-        case 0x9c: case 0x9d: case 0x9e: case 0x9f:
-        case 0xde:
-        {
-            if (*opcode == 0xde || *opcode == 0x9e) st.opcycles = 7;
-            else st.opcycles = 4;
-            //from the 8080 programmers' manual:
-            //the carry is internally added to the
-            //second operand and subtraction then performed with normal
-            //two's complement rules.
-            byte r2;
-            if (*opcode == 0xde) {
-                r2 = ~opcode[1]; st.opbytes = 2;
-            } else {
-                r2 = ~arithmeticOperand(*opcode - 0x98, state);
-            }
-            uint16_t res = state->reg[0] + r2 + !(state->fl.cy);
-            state->fl.ac = (state->reg[0] & 0x0f) + (r2 & 0x0f) + !(state->fl.cy) > 0x0f;
-            set_result(res, state);
-            state->fl.cy = !state->fl.cy;
-            break;
-        }
-        //ANA, ANI
-        case 0xa0: case 0xa1: case 0xa2: case 0xa3:
-        case 0xa4: case 0xa5: case 0xa6: case 0xa7:
-        case 0xe6:
-        {
-            if (*opcode == 0xe6 || *opcode == 0xa6) st.opcycles = 7;
-            else st.opcycles = 4;
-            byte r2;
-            if (*opcode == 0xe6) {
-                r2 = opcode[1]; st.opbytes = 2;
-            } else {
-                r2 = arithmeticOperand(*opcode - 0xa0, state);
-            }
-            uint16_t res = (uint16_t) state->reg[0] & (uint16_t) r2;
-            //the behaviour of bitwise comparisons and the ac flag
-            //is poorly documented in the programmers' manual
-            state->fl.ac = ((state->reg[0] | r2) & 0x08) != 0;
-            set_result(res, state);
-            break;
-        }
-        //XRA, XRI
-        case 0xa8: case 0xa9: case 0xaa: case 0xab:
-        case 0xac: case 0xad: case 0xae: case 0xaf:
-        case 0xee:
-        {
-            if (*opcode == 0xee || *opcode == 0xae) st.opcycles = 7;
-            else st.opcycles = 4;
-            byte r2;
-            if (*opcode == 0xee) {
-                r2 = opcode[1]; st.opbytes = 2;
-            } else {
-                r2 = arithmeticOperand(*opcode - 0xa8, state);
-            }
-            uint16_t res = (uint16_t) state->reg[0] ^ (uint16_t) r2;
-            set_result(res, state);
-            state->fl.ac = 0;
-            break;
-        }
-        //ORA, ORI
-        case 0xb0: case 0xb1: case 0xb2: case 0xb3:
-        case 0xb4: case 0xb5: case 0xb6: case 0xb7:
-        case 0xf6:
-        {
-            if (*opcode == 0xf6 || *opcode == 0xb6) st.opcycles = 7;
-            else st.opcycles = 4;
-            byte r2;
-            if (*opcode == 0xf6) {
-                r2 = opcode[1]; st.opbytes = 2;
-            } else {
-                r2 = arithmeticOperand(*opcode - 0xb0, state);
-            }
-            uint16_t res = (uint16_t) state->reg[0] | (uint16_t) r2;
-            set_result(res, state);
-            state->fl.ac = 0;
-            break;
-        }
-        //CMP, CPI
-        case 0xb8: case 0xb9: case 0xba: case 0xbb:
-        case 0xbc: case 0xbd: case 0xbe: case 0xbf:
-        case 0xfe:
-        {
-            if (*opcode == 0xfe || *opcode == 0xbe) st.opcycles = 7;
-            else st.opcycles = 4;
-            //CMP does not affect the accumulator.
-            //arg is subtracted from accumulator internally to
-            //set flags.
-            byte r2;
-            if (*opcode == 0xfe) {
-                r2 = ~opcode[1]; st.opbytes = 2;
-            } else {
-                r2 = ~arithmeticOperand(*opcode - 0xb8, state);
-            }
-            uint16_t res = state->reg[0] + r2 + 1;
-            state->fl.ac = (state->reg[0] & 0x0f) + (r2 & 0x0f) + 1 > 0x0f;
-            set_flags(res, state);
-            state->fl.cy = !state->fl.cy;
-            break;
-        }
-        //RLC
-        case 0x07:
-        {
-            st.opcycles = 4;
-            state->fl.cy = state->reg[0] >= 0x80;
-            state->reg[0] <<= 1;
-            state->reg[0] += state->fl.cy;
-            break;
-        }
-        //RRC
-        case 0x0f:
-        {
-            st.opcycles = 4;
-            state->fl.cy = state->reg[0] & 0x01;
-            state->reg[0] >>= 1;
-            state->reg[0] += state->fl.cy * 0x80;
-            break;
-        }
-        //RAL
-        case 0x17:
-        {
-            st.opcycles = 4;
-            int tmp = state->fl.cy;
-            state->fl.cy = state->reg[0] >= 0x80;
-            state->reg[0] <<= 1;
-            state->reg[0] += tmp;
-            break;
-        }
-        //RAR
-        case 0x1f:
-        {
-            st.opcycles = 4;
-            int tmp = state->fl.cy;
-            state->fl.cy = state->reg[0] & 0x01;
-            state->reg[0] >>= 1;
-            state->reg[0] += tmp * 0x80;
-            break;
-        }
-        //PUSH
-        case 0xc5: case 0xd5: case 0xe5: case 0xf5:
-        {
-            st.opcycles = 11;
-            if (state->sp < 2) {
-                fprintf(stderr, "Stack overflow on PUSH!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
-            }
-            int r1 = 2*((*opcode - 0xc5)/0x10) + 1;
-            state->sp -= 2;
-            if (r1 < 7) {
-                state->memory[state->sp + 1] = state->reg[r1];
-                state->memory[state->sp] = state->reg[r1 + 1];
-            } else { //PUSH PSW
-                //formatting of the flag storage in memory
-                //(see 8080 asm programmer's manual)
-                byte flagbyte = state->fl.cy + 2 + (state->fl.p << 2) + 
-                                (state->fl.ac << 4) + (state->fl.z << 6) +
-                                (state->fl.s << 7);
-                state->memory[state->sp + 1] = state->reg[0];
-                state->memory[state->sp] = flagbyte;
-            }
-            break;
-        }
-        //POP
-        case 0xc1: case 0xd1: case 0xe1: case 0xf1:
-        {
-            st.opcycles = 10;
-            if (state->sp > state->mem_size - 2) {
-                fprintf(stderr, "Stack underflow on POP!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
-            }
-            int r1 = 2*((*opcode - 0xc1)/0x10) + 1;
-            if (r1 < 7) {
-                state->reg[r1] = state->memory[state->sp + 1];
-                state->reg[r1 + 1] = state->memory[state->sp];
-            } else { //POP PSW
-                //formatting of the flag storage in memory
-                //(see 8080 asm programmer's manual)
-                byte flagbyte = state->memory[state->sp];
-                state->fl.cy = flagbyte & 0x01;
-                state->fl.p = (flagbyte & 0x04) > 0;
-                state->fl.ac = (flagbyte & 0x10) > 0;
-                state->fl.z = (flagbyte & 0x40) > 0;
-                state->fl.s = (flagbyte & 0x80) > 0;
-                state->reg[0] = state->memory[state->sp + 1];
-            }
-            state->sp += 2;
-            break;
-        }
-        //DAD
-        case 0x09: case 0x19: case 0x29: case 0x39:
-        {
-            st.opcycles = 10;
-            int r1 = 2*((*opcode - 0x09)/0x10) + 1;
-            int arg1;
-            if (r1 < 7) {
-                arg1 = state->reg[r1] << 8 | state->reg[r1 + 1];
-            } else { // DAD SP
-                arg1 = state->sp;
-            }
-            int arg2 = state->reg[5] << 8 | state->reg[6];
-            int res = arg1 + arg2;
-            state->fl.cy = res > 0xffff;
-            state->reg[5] = (res >> 8) & 0xff;
-            state->reg[6] = res & 0xff;
-            break;
+    }
+}
+
+//drop the decoded instructions in code page that include the byte at
+//offset in the host memory page host
+static void invalidate_in(MemoryMap *map, DecodeCache *dc,
+                          int code, byte *host, int offset) {
+    for (int back = 0; back < 3; back++) {
+        int start = offset - back;
+        DecodedOp *d;
+        if (start >= 0 && map->read[code] == host)
+            d = &dc->ops[code][start];
+        else if (start < 0 && code < 255 && map->read[code + 1] == host)
+            d = &dc->ops[code][PAGE_SIZE + start];
+        else continue;
+        //the instruction has to include the byte
+        if (back >= d->len) continue;
+        //translated blocks never run past the end of their page
+        if (d->in_block) drop_translated(dc, code);
+        d->handler = NULL;
+    }
+}
+
+//drop the decoded instructions a write to offset in page changes. the
+//write can only reach instructions in that page or running into it
+//from the one before, unless some code is reached through an alias.
+static void invalidate_code(MemoryMap *map, DecodeCache *dc,
+                            int page, int offset) {
+    byte *host = dc->watched[page];
+    if (dc->aliased) {
+        for (int i = 0; i < dc->ncode; i++)
+            invalidate_in(map, dc, dc->code_pages[i], host, offset);
+        return;
+    }
+    if (dc->ops[page]) invalidate_in(map, dc, page, host, offset);
+    if (page > 0 && dc->ops[page - 1])
+        invalidate_in(map, dc, page - 1, host, offset);
+}
+
+//decode an instruction into d, from bytes that are all in one page
+static void decode_into(DecodedOp *d, const byte *bytes) {
+    for (int i = 0; i < 3; i++) d->bytes[i] = bytes[i];
+    d->handler = optable[d->bytes[0]];
+    d->len = oplen[d->bytes[0]];
+    d->cycles = opcycles[d->bytes[0]];
+}
+
+//whether no page of the address space writes to the host memory page
+//reads from
+static int read_only(MemoryMap *map, DecodeCache *dc, int page) {
+    for (int i = 0; i < 256; i++)
+        if (page_write(map, dc, i) == map->read[page]) return 0;
+    return 1;
+}
+
+//the shared page on the list starting at p decoded from the bytes
+//code, if there is one
+static SharedPage *find_shared(SharedPage *p, const byte *code) {
+    for (; p; p = p->next)
+        if (memcmp(p->code, code, PAGE_SIZE) == 0) return p;
+    return NULL;
+}
+
+//take page's decoded instructions from the shared code, adding them to
+//it first if no other state has
+static void share_page(CPUState *state, int page) {
+    DecodeCache *dc = state->decoded;
+    const byte *code = state->map->read[page];
+    _Atomic(SharedPage *) *list = &dc->shared->pages[page];
+    SharedPage *head = atomic_load(list);
+    SharedPage *sp = find_shared(head, code);
+    if (!sp) {
+        SharedPage *added = calloc(1, sizeof(SharedPage));
+        byte bytes[PAGE_SIZE + 2] = {0};
+        memcpy(added->code, code, PAGE_SIZE);
+        memcpy(bytes, code, PAGE_SIZE);
+        for (int k = 0; k < PAGE_SIZE; k++)
+            if (k + oplen[code[k]] <= PAGE_SIZE)
+                decode_into(&added->ops[k], &bytes[k]);
+        //another state could have added the same page in the meantime
+        do {
+            added->next = head;
+            sp = find_shared(head, code);
+        } while (!sp && !atomic_compare_exchange_weak(list, &head, added));
+        if (sp) free(added);
+        else sp = added;
+    }
+    dc->ops[page] = sp->ops;
+    dc->code_pages[dc->ncode++] = page;
+    dc->shared_hits[page] = calloc(PAGE_SIZE, 1);
+}
+
+static NOINLINE DecodedOp *decode_op(CPUState *state, uint16_t pc) {
+    DecodeCache *dc = state->decoded;
+    int page = pc >> 8, last = (uint16_t) (pc + 2) >> 8;
+    DecodedOp *d = &dc->uncached;
+    if (!dc->ops[page] && dc->shared && state->map->read[page] &&
+        read_only(state->map, dc, page))
+        share_page(state, page);
+    //only instructions read from host memory can be kept, since a
+    //device could change what the others read as. an instruction
+    //missing from a shared page isn't kept either.
+    if (state->map->read[page] && state->map->read[last] && last >= page &&
+        !dc->shared_hits[page]) {
+        if (!dc->ops[page]) {
+            dc->ops[page] = calloc(PAGE_SIZE, sizeof(DecodedOp));
+            dc->code_pages[dc->ncode++] = page;
         }
-        //INX
-        case 0x03: case 0x13: case 0x23: case 0x33:
-        {
-            st.opcycles = 5;
-            int r1 = 2*((*opcode - 0x03)/0x10) + 1;
-            if (r1 < 7) {
-                uint16_t res = (state->reg[r1] << 8 | state->reg[r1 + 1]) + 1;
-                state->reg[r1] = res >> 8;
-                state->reg[r1 + 1] = res & 0xff;
-            } else { //INX SP
-                state->sp += 1;
-            }
+        watch_code_page(state, page);
+        if (last != page) watch_code_page(state, last);
+        d = &dc->ops[page][pc & 0xff];
+    }
+    byte bytes[3];
+    for (int i = 0; i < 3; i++) bytes[i] = read_byte(state, pc + i);
+    decode_into(d, bytes);
+    d->hits = 0;
+    d->in_block = 0;
+    return d;
+}
+
+//the decoded instruction at pc
+static ALWAYS_INLINE DecodedOp *decoded_at(CPUState *state, uint16_t pc) {
+    DecodedOp *page = state->decoded->ops[pc >> 8];
+    if (LIKELY(page != NULL)) {
+        DecodedOp *d = &page[pc & 0xff];
+        if (LIKELY(d->handler != NULL)) return d;
+    }
+    return decode_op(state, pc);
+}
+
+//this state's count of the times runCPU has reached the decoded
+//instruction d at pc outside translated code
+static ALWAYS_INLINE byte *hits_at(DecodeCache *dc, DecodedOp *d,
+                                   uint16_t pc) {
+    byte *shared = dc->shared_hits[pc >> 8];
+    return shared ? &shared[pc & 0xff] : &d->hits;
+}
+
+//stepCPU on the plain core
+static int step(CPUState *state) {
+    OpStats st;
+    state->trap = TRAP_NONE;
+    if (state->halted) {
+        //nothing runs until an interrupt
+        state->write_flag = -1;
+        return opcycles[0x00];
+    }
+    state->lf = lazyFlags(state->fl);
+    if (state->decoded) {
+        DecodedOp *d = decoded_at(state, state->pc);
+        state->write_flag = -1;
+        st = d->handler(state, d->bytes);
+    } else {
+        byte buf[3];
+        st = executeOp(state, fetch_op(state, buf));
+    }
+    state->pc += st.opbytes;
+    state->fl = flagsView(state->lf);
+    return st.opcycles;
+}
+
+//whether the last instruction stopped on a trap (which only a
+//CPU_CHECKS build can)
+#ifdef CPU_CHECKS
+#define TRAPPED (state->trap != TRAP_NONE)
+#else
+#define TRAPPED 0
+#endif
+
+/*
+    Threaded blocks. With these on, runCPU turns the code at each
+    address it has reached BLOCK_THRESHOLD times into a block: the
+    handlers and operands of the instructions from there to the end of
+    the basic block, which it then calls one after another. Only the
+    last instruction of a block can branch, so the ones before it leave
+    pc alone and take the cycles the opcode table gives them, and pc
+    and the cycle count are only brought up to date when the block is
+    left. Blocks are kept, and dropped when their code is written to,
+    the same way as the JIT's, and need nothing more from the host
+    than C.
+*/
+#ifndef BLOCK_THRESHOLD
+#define BLOCK_THRESHOLD 2
+#endif
+#define BLOCK_MAX_OPS 32 //instructions in a block
+
+//whether the instruction ends a block
+static int ends_block(byte op) {
+    return (op & 0xc7) == 0xc0 || (op & 0xc7) == 0xc2 ||
+           (op & 0xc7) == 0xc4 || (op & 0xc7) == 0xc7 ||
+           op == 0xc3 || op == 0xc9 || op == 0xcd || op == 0xd3 ||
+           op == 0xe9;
+}
+
+//whether the instruction writes memory through a write that can
+//leave the block part way through (if it drops translated code)
+static int leaves_block_early(byte op) {
+    switch (op) {
+        case 0x02: case 0x12: case 0x22: case 0x32: //stores
+        case 0x34: case 0x35: case 0x36: //INR M, DCR M, MVI M
+        case 0xc5: case 0xd5: case 0xe5: case 0xf5: //PUSH
+        case 0xe3: //XTHL
+            return 1;
+    }
+    return op >= 0x70 && op < 0x78; //MOV M, r
+}
+
+//dead flag elimination: for each of the n instructions of a block, the
+//flags that something reads after it before they are set again. the
+//flags are part of the state the host and guest see wherever a block
+//can be left (at its end, whether that is RET, PCHL or any other
+//branch, and after a write that drops it), and interrupts are only
+//taken between runCPU calls, so all of them are live at those points.
+static void flags_live(DecodedOp **ops, int n, int *live) {
+    int after = FLAGS_ALL;
+    for (int i = n - 1; i >= 0; i--) {
+        byte op = ops[i]->bytes[0];
+        if (leaves_block_early(op)) after = FLAGS_ALL;
+        live[i] = after;
+        after = (after & ~flags_written[op]) | flags_read[op];
+    }
+}
+
+#ifndef CPU_CHECKS
+//handlers that leave the flags alone, for the opcodes that have them
+#define NF_ROW(code, op) \
+    [code] = op_##op##_B_nf, [code + 1] = op_##op##_C_nf, \
+    [code + 2] = op_##op##_D_nf, [code + 3] = op_##op##_E_nf, \
+    [code + 4] = op_##op##_H_nf, [code + 5] = op_##op##_L_nf, \
+    [code + 6] = op_##op##_M_nf, [code + 7] = op_##op##_A_nf
+static const OpHandler noflags_table[256] = {
+    NF_ROW(0x80, add), NF_ROW(0x88, adc), NF_ROW(0x90, sub),
+    NF_ROW(0x98, sbb), NF_ROW(0xa0, ana), NF_ROW(0xa8, xra),
+    NF_ROW(0xb0, ora), NF_ROW(0xb8, cmp),
+    [0xc6] = op_add_imm_nf, [0xce] = op_adc_imm_nf,
+    [0xd6] = op_sub_imm_nf, [0xde] = op_sbb_imm_nf,
+    [0xe6] = op_ana_imm_nf, [0xee] = op_xra_imm_nf,
+    [0xf6] = op_ora_imm_nf, [0xfe] = op_cmp_imm_nf,
+    [0x04] = op_inr_B_nf, [0x0c] = op_inr_C_nf, [0x14] = op_inr_D_nf,
+    [0x1c] = op_inr_E_nf, [0x24] = op_inr_H_nf, [0x2c] = op_inr_L_nf,
+    [0x34] = op_inr_M_nf, [0x3c] = op_inr_A_nf,
+    [0x05] = op_dcr_B_nf, [0x0d] = op_dcr_C_nf, [0x15] = op_dcr_D_nf,
+    [0x1d] = op_dcr_E_nf, [0x25] = op_dcr_H_nf, [0x2d] = op_dcr_L_nf,
+    [0x35] = op_dcr_M_nf, [0x3d] = op_dcr_A_nf
+};
+#endif
+
+//the handler a block runs for an instruction, given the flags live
+//after it: one that leaves the flags alone if nothing reads those it
+//sets. with CPU_CHECKS, any instruction could trap and leave the block
+//before it runs, so the flags are kept everywhere.
+static OpHandler block_handler(DecodedOp *d, int live) {
+    byte code = d->bytes[0];
+#ifndef CPU_CHECKS
+    if (!(live & flags_written[code]) && noflags_table[code])
+        return noflags_table[code];
+#else
+    (void) live;
+#endif
+    return handler_table[code];
+}
+
+//the decoded instructions of the block at pc, returning how many. a
+//block stops before HLT and anything that can't be cached, and at the
+//end of its page, so that writes to it are caught by the watch on
+//that page alone.
+static int find_block(CPUState *state, uint16_t pc, DecodedOp **ops) {
+    DecodeCache *dc = state->decoded;
+    int n = 0;
+    uint16_t adr = pc;
+    while (n < BLOCK_MAX_OPS) {
+        DecodedOp *d = decoded_at(state, adr);
+        byte op = d->bytes[0];
+        if (d == &dc->uncached || op == 0x76 ||
+            (adr & 0xff) + d->len > PAGE_SIZE || adr >> 8 != pc >> 8)
             break;
+        ops[n++] = d;
+        adr += d->len;
+        if (ends_block(op)) break;
+    }
+    return n;
+}
+
+static Block *translate_block(CPUState *state, uint16_t pc) {
+    DecodedOp *ops[BLOCK_MAX_OPS];
+    int live[BLOCK_MAX_OPS];
+    int n = find_block(state, pc, ops), cycles = 0;
+    //shared code is never written to, so it needn't be marked
+    int shared = state->decoded->shared_hits[pc >> 8] != NULL;
+    if (n == 0) return NULL;
+    flags_live(ops, n, live);
+    Block *b = malloc(sizeof(Block) + n * sizeof(BlockOp));
+    b->nops = n;
+    for (int i = 0; i < n; i++) {
+        BlockOp *op = &b->ops[i];
+        op->handler = block_handler(ops[i], live[i]);
+        for (int k = 0; k < 3; k++) op->bytes[k] = ops[i]->bytes[k];
+        op->pc = pc;
+        op->cycles = cycles;
+        pc += ops[i]->len;
+        cycles += ops[i]->cycles;
+        if (!shared) ops[i]->in_block = 1;
+    }
+    //the same block, if another state sharing the code got there first
+    Block *first = NULL;
+    if (!atomic_compare_exchange_strong(&ops[0]->block, &first, b)) {
+        free(b);
+        return first;
+    }
+    return b;
+}
+
+//runCPU with threaded blocks on. anything that isn't in a block is run
+//one instruction at a time.
+static NOINLINE int run_threaded(CPUState *state, int cycle_budget) {
+    DecodeCache *dc = state->decoded;
+    int cycles = 0;
+    OpStats st;
+    state->write_flag = -1;
+    state->trap = TRAP_NONE;
+    state->lf = lazyFlags(state->fl);
+    while (cycles < cycle_budget) {
+        DecodedOp *d = decoded_at(state, state->pc);
+        Block *b = d->block;
+        if (!b && d != &dc->uncached &&
+            ++*hits_at(dc, d, state->pc) >= BLOCK_THRESHOLD) {
+            b = translate_block(state, state->pc);
+            if (!b) *hits_at(dc, d, state->pc) = 0;
         }
-        //DCX
-        case 0x0b: case 0x1b: case 0x2b: case 0x3b:
-        {
-            st.opcycles = 5;
-            int r1 = 2*((*opcode - 0x0b)/0x10) + 1;
-            if (r1 < 7) {
-                uint16_t res = (state->reg[r1] << 8 | state->reg[r1 + 1]) - 1;
-                state->reg[r1] = res >> 8;
-                state->reg[r1 + 1] = res & 0xff;
-            } else { //INX SP
-                state->sp -= 1;
+        //a block is only run if runCPU would stop no earlier than its
+        //last instruction
+        if (b && cycles + b->ops[b->nops - 1].cycles < cycle_budget) {
+            BlockOp *op = b->ops, *last = op + b->nops - 1;
+            dc->dropped = 0;
+            for (; op < last; op++) {
+                op->handler(state, op->bytes);
+                //leave the block if it could have been written over
+                if (dc->dropped || TRAPPED) break;
             }
-            break;
-        }
-        //XCHG
-        case 0xeb:
-        {
-            st.opcycles = 5;
-            uint16_t tmp = state->reg[5] << 8 | state->reg[6];
-            state->reg[5] = state->reg[3];
-            state->reg[6] = state->reg[4];
-            state->reg[3] = tmp >> 8;
-            state->reg[4] = tmp & 0xff;
-            break;
-        }
-        //XTHL
-        case 0xe3:
-        {
-            st.opcycles = 18;
-            if (state->sp > state->mem_size - 2) {
-                fprintf(stderr, "Stack underflow on XTHL!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
+            if (op < last) {
+                if (TRAPPED) {
+                    //the instruction wasn't run
+                    state->pc = op->pc;
+                    cycles += op->cycles;
+                    break;
+                }
+                state->pc = op[1].pc;
+                cycles += op[1].cycles;
+                continue;
             }
-            uint16_t tmp = state->reg[5] << 8 | state->reg[6];
-            state->reg[6] = state->memory[state->sp];
-            state->reg[5] = state->memory[state->sp + 1];
-            state->memory[state->sp] = tmp & 0xff;
-            state->memory[state->sp+1] = tmp >> 8;
+            state->pc = last->pc;
+            st = table_stats(last->bytes[0],
+                             last->handler(state, last->bytes));
+            cycles += last->cycles;
+        } else st = d->handler(state, d->bytes);
+        state->pc += st.opbytes;
+        cycles += st.opcycles;
+        if (st.opcycles == 0 || state->halted || state->write_flag >= 0)
             break;
-        }
-        //SPHL
-        case 0xf9:
-        {
-            st.opcycles = 5;
-            state->sp = state->reg[5] << 8 | state->reg[6];
-            break;
-        }
-        //LXI
-        case 0x01: case 0x11: case 0x21: case 0x31:
-        {
-            st.opcycles = 10;
-            int r1 = 2*((*opcode - 0x01)/0x10) + 1;
-            if (r1 < 7) {
-                state->reg[r1] = opcode[2];
-                state->reg[r1 + 1] = opcode[1];
-            } else { //LXI SP
-                state->sp = opcode[2] << 8 | opcode[1];
+    }
+    free_dead_blocks(dc);
+    state->fl = flagsView(state->lf);
+    return cycles;
+}
+
+void enableThreadedBlocks(CPUState *cs) {
+    enableDecodeCache(cs);
+    cs->decoded->threaded = 1;
+}
+
+/*
+    JIT. With CPU_JIT on an x86-64 host, runCPU translates the code at
+    each address it has reached JIT_THRESHOLD times into a block of
+    x86-64 code, and runs that instead of the handlers from then on. A
+    block ends after a jump, call, return, RST or OUT, before HLT and
+    DAA (which are left to the handlers), and at the end of its page,
+    so that the decode cache's watch on the pages it was decoded from
+    sees every write that changes it. Such a write drops the page's
+    blocks, and if it came from translated code, the block doing it is
+    left after that instruction.
+
+    Translated code keeps the 8080 registers in host registers: A in
+    r12, BC, DE and HL in r13-r15, SP in r8, the lazy flag word in r9
+    and the cycle count in r10, with the state in rbp and the memory map
+    in rbx. An instruction only works out the flag word if something
+    can read it before another instruction replaces it, and cycles are
+    added once on each way out of a block. A block is only run if all
+    of it fits in what is left of the budget (runCPU stops on the same
+    instruction as without the JIT). A way out to a fixed address is
+    patched to jump straight to the block there once there is one, and
+    returns look their block up without leaving translated code.
+*/
+#ifdef JIT_X86_64
+
+//how many times an address is reached before a block is translated
+//from it
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 16
+#endif
+#define JIT_BUFFER_SIZE (4 << 20)
+#define JIT_MAX_OP_CODE 256 //host code for one instruction, at most
+#define JIT_MAX_BLOCKS 8192
+#define JIT_MAX_LINKS 16384
+
+typedef struct JitBlock {
+    uint16_t start;
+    int next; //next block on the same page, -1 at the end
+    int links; //first jump patched to come here, -1 for none
+} JitBlock;
+
+//a jump from one block to another, which is unpatched (to leave the
+//block instead) if the block it goes to is dropped
+typedef struct JitLink {
+    byte *site; //the rel32 field of the jump
+    int next;
+} JitLink;
+
+//the out of line part of a memory access, for pages the map doesn't
+//give host memory for. these are put after the block.
+typedef struct JitSlow {
+    byte *site[2]; //rel32 fields of the jumps to it
+    byte *resume; //where to go back to
+    void *helper;
+    int write;
+    int exit; //whether to leave the block if the write dropped code
+    uint16_t exit_pc;
+    int exit_cycles;
+} JitSlow;
+
+struct Jit {
+    byte *buf, *code, *p, *end; //buffer, first block, next free byte
+    //the way into translated code, which returns the cycle count and
+    //sets *site to the jump to patch to the next block (or NULL), and
+    //the ways out of it, the second with that jump in rax
+    int (*enter)(CPUState *state, byte *code, int cycles, int budget,
+                 byte **site);
+    byte *exit, *exit_link;
+    //translated code for each address, by page
+    byte **entry[256];
+    int page_blocks[256]; //first block on each page, -1 for none
+    JitBlock blocks[JIT_MAX_BLOCKS];
+    int nblocks;
+    JitLink links[JIT_MAX_LINKS];
+    int nlinks;
+    unsigned flushes; //jumps from before a flush can't be patched
+    JitSlow slow[2 * BLOCK_MAX_OPS];
+    int nslow;
+};
+
+//host registers, and the ones the 8080 state is kept in
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+#define J_MAP RBX
+#define J_STATE RBP
+#define J_A R12
+#define J_HL R15
+#define J_SP R8
+#define J_LF R9
+#define J_CYCLES R10
+//by the register pair field of the opcode (SP for 3)
+static const int pair_reg[4] = {R13, R14, R15, R8};
+
+//x86 opcodes, with the /digit of the group 1 and shift instructions
+#define X_ADD 0x01
+#define X_OR 0x09
+#define X_AND 0x21
+#define X_XOR 0x31
+#define X_TEST 0x85
+#define X_XCHG 0x87
+#define X_MOV 0x89
+#define X_LOAD 0x8b
+#define X_MOVZX8 0x0fb6
+#define X_MOVZX16 0x0fb7
+#define G_ADD 0
+#define G_OR 1
+#define G_AND 4
+#define G_SUB 5
+#define G_XOR 6
+#define G_CMP 7
+#define G_ROL 0
+#define G_ROR 1
+#define G_SHL 4
+#define G_SHR 5
+//condition codes for jcc
+#define X_JE 0x4
+#define X_JNE 0x5
+#define X_JL 0xc
+
+static void emit(Jit *j, int b) {
+    *j->p++ = b;
+}
+
+static void emit16(Jit *j, uint16_t v) {
+    memcpy(j->p, &v, 2);
+    j->p += 2;
+}
+
+static void emit32(Jit *j, uint32_t v) {
+    memcpy(j->p, &v, 4);
+    j->p += 4;
+}
+
+static void emit64(Jit *j, uint64_t v) {
+    memcpy(j->p, &v, 8);
+    j->p += 8;
+}
+
+//operand size prefix, REX prefix and opcode for an instruction of
+//size bits (8 never uses spl, bpl, sil or dil, so needs no REX of its
+//own). index is -1 for none.
+static void emit_op(Jit *j, int size, int op, int reg, int index, int rm) {
+    int rex = (size == 64) << 3 | (reg & 8) >> 1 |
+              (index >= 0 ? (index & 8) >> 2 : 0) | (rm & 8) >> 3;
+    if (size == 16) emit(j, 0x66);
+    if (rex) emit(j, 0x40 | rex);
+    if (op > 0xff) emit(j, op >> 8);
+    emit(j, op & 0xff);
+}
+
+//op reg, rm with both registers
+static void op_rr(Jit *j, int size, int op, int reg, int rm) {
+    emit_op(j, size, op, reg, -1, rm);
+    emit(j, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+//op reg, [base + index << scale + disp] (index -1 for none)
+static void op_mem(Jit *j, int size, int op, int reg,
+                   int base, int index, int scale, int32_t disp) {
+    int mod = disp == 0 && (base & 7) != RBP ? 0 :
+              disp >= -128 && disp < 128 ? 1 : 2;
+    emit_op(j, size, op, reg, index, base);
+    if (index >= 0 || (base & 7) == RSP) {
+        emit(j, mod << 6 | (reg & 7) << 3 | 4);
+        emit(j, scale << 6 | ((index >= 0 ? index : RSP) & 7) << 3 |
+                (base & 7));
+    } else emit(j, mod << 6 | (reg & 7) << 3 | (base & 7));
+    if (mod == 1) emit(j, disp);
+    else if (mod == 2) emit32(j, disp);
+}
+
+//the state's fields, from rbp
+#define STATE_FIELD(size, op, reg, field) \
+    op_mem(j, (size), (op), (reg), J_STATE, -1, 0, \
+           offsetof(CPUState, field))
+
+static void mov_rr(Jit *j, int dst, int src) {
+    op_rr(j, 32, X_MOV, src, dst);
+}
+
+static void mov_ri(Jit *j, int dst, uint32_t imm) {
+    if (dst & 8) emit(j, 0x41);
+    emit(j, 0xb8 | (dst & 7));
+    emit32(j, imm);
+}
+
+static void mov_ri64(Jit *j, int dst, const void *ptr) {
+    emit(j, 0x48 | (dst & 8) >> 3);
+    emit(j, 0xb8 | (dst & 7));
+    emit64(j, (uint64_t) ptr);
+}
+
+static void alu_rr(Jit *j, int op, int dst, int src) {
+    op_rr(j, 32, op, src, dst);
+}
+
+static void alu_ri(Jit *j, int group, int dst, int32_t imm) {
+    if (imm >= -128 && imm < 128) {
+        op_rr(j, 32, 0x83, group, dst);
+        emit(j, imm);
+    } else {
+        op_rr(j, 32, 0x81, group, dst);
+        emit32(j, imm);
+    }
+}
+
+static void shift_ri(Jit *j, int group, int dst, int n) {
+    op_rr(j, 32, 0xc1, group, dst);
+    emit(j, n);
+}
+
+static void test_ri(Jit *j, int reg, uint32_t imm) {
+    op_rr(j, 32, 0xf7, 0, reg);
+    emit32(j, imm);
+}
+
+static void push_r(Jit *j, int reg) {
+    if (reg & 8) emit(j, 0x41);
+    emit(j, 0x50 | (reg & 7));
+}
+
+static void pop_r(Jit *j, int reg) {
+    if (reg & 8) emit(j, 0x41);
+    emit(j, 0x58 | (reg & 7));
+}
+
+//jumps are emitted with rel32 0 (the next instruction), and return
+//where the rel32 is so it can be patched
+static byte *jmp32(Jit *j) {
+    emit(j, 0xe9);
+    emit32(j, 0);
+    return j->p - 4;
+}
+
+static byte *jcc32(Jit *j, int cc) {
+    emit(j, 0x0f);
+    emit(j, 0x80 | cc);
+    emit32(j, 0);
+    return j->p - 4;
+}
+
+static void patch(byte *site, byte *target) {
+    int32_t rel = target - (site + 4);
+    memcpy(site, &rel, 4);
+}
+
+static void jmp_to(Jit *j, byte *target) {
+    patch(jmp32(j), target);
+}
+
+//an 8080 register (by the 3-bit field of the opcode, not M) into dst
+static void get_reg(Jit *j, int r, int dst) {
+    if (r == 7) mov_rr(j, dst, J_A);
+    else if (r & 1) op_rr(j, 32, X_MOVZX8, dst, pair_reg[r >> 1]);
+    else {
+        mov_rr(j, dst, pair_reg[r >> 1]);
+        shift_ri(j, G_SHR, dst, 8);
+    }
+}
+
+//src (holding 0-255, which may be lost) into an 8080 register
+static void set_reg(Jit *j, int r, int src) {
+    int pair = pair_reg[r >> 1];
+    if (r == 7) mov_rr(j, J_A, src);
+    else if (r & 1) op_rr(j, 8, 0x88, src, pair);
+    else {
+        alu_ri(j, G_AND, pair, 0xff);
+        shift_ri(j, G_SHL, src, 8);
+        alu_rr(j, X_OR, pair, src);
+    }
+}
+
+//memory accesses called from translated code when the map has no host
+//memory for the page. a write returns whether it dropped translated
+//code.
+static uint32_t jit_read8(CPUState *state, uint32_t adr) {
+    return read_byte(state, adr);
+}
+
+static uint32_t jit_read16(CPUState *state, uint32_t adr) {
+    return read_byte(state, adr) | read_byte(state, (uint16_t) (adr + 1)) << 8;
+}
+
+static uint32_t jit_write8(CPUState *state, uint32_t adr, uint32_t val) {
+    state->decoded->dropped = 0;
+    write_byte(state, adr, val);
+    return state->decoded->dropped;
+}
+
+static uint32_t jit_write16(CPUState *state, uint32_t adr, uint32_t val) {
+    state->decoded->dropped = 0;
+    write_byte(state, adr, val & 0xff);
+    write_byte(state, adr + 1, val >> 8);
+    return state->decoded->dropped;
+}
+
+//the order PUSH writes in
+static uint32_t jit_push16(CPUState *state, uint32_t adr, uint32_t val) {
+    state->decoded->dropped = 0;
+    write_byte(state, adr + 1, val >> 8);
+    write_byte(state, adr, val & 0xff);
+    return state->decoded->dropped;
+}
+
+//IN and OUT called from translated code for ports with a handler
+static uint32_t jit_in(CPUState *state, uint32_t port) {
+    return state->map->in[port](state->map->ctx, port);
+}
+
+static uint32_t jit_out(CPUState *state, uint32_t port, uint32_t val) {
+    state->map->out[port](state->map->ctx, port, val);
+    return 0;
+}
+
+//take the slow path to helper, with the port in ecx (and A in eax for
+//a write), if the port has a handler in the map's table at offset
+//table. the caller sets where it resumes. rax, rcx and rdx are lost.
+static JitSlow *emit_port(Jit *j, int port, size_t table, void *helper,
+                          int write) {
+    JitSlow *s = &j->slow[j->nslow++];
+    s->site[1] = NULL;
+    mov_ri(j, RCX, port);
+    if (write) mov_rr(j, RAX, J_A);
+    op_mem(j, 64, X_LOAD, RDX, J_MAP, -1, 0, table + port * sizeof(void *));
+    op_rr(j, 64, X_TEST, RDX, RDX);
+    s->site[0] = jcc32(j, X_JNE);
+    s->helper = helper;
+    s->write = write;
+    s->exit = 0;
+    return s;
+}
+
+//read the byte (or little-endian word) at the address in ecx into eax,
+//through the map. a word that runs into the next page takes the slow
+//path. rcx and rdx are lost.
+static void emit_read(Jit *j, int word) {
+    JitSlow *s = &j->slow[j->nslow++];
+    s->site[1] = NULL;
+    if (word) {
+        op_rr(j, 8, 0x80, G_CMP, RCX);
+        emit(j, 0xff);
+        s->site[1] = jcc32(j, X_JE);
+    }
+    mov_rr(j, RDX, RCX);
+    shift_ri(j, G_SHR, RDX, 8);
+    op_mem(j, 64, X_LOAD, RDX, J_MAP, RDX, 3, offsetof(MemoryMap, read));
+    op_rr(j, 64, X_TEST, RDX, RDX);
+    s->site[0] = jcc32(j, X_JE);
+    op_rr(j, 32, X_MOVZX8, RCX, RCX);
+    op_mem(j, 32, word ? X_MOVZX16 : X_MOVZX8, RAX, RDX, RCX, 0, 0);
+    s->resume = j->p;
+    s->helper = word ? (void *) jit_read16 : (void *) jit_read8;
+    s->write = 0;
+    s->exit = 0;
+}
+
+//write al (or ax) to the address in ecx. if exit is set and the write
+//drops translated code, the block is left with pc at next_pc and
+//cycles cycles taken. rax, rcx and rdx are lost.
+static void emit_write(Jit *j, int word, void *helper, int exit,
+                       uint16_t next_pc, int cycles) {
+    JitSlow *s = &j->slow[j->nslow++];
+    s->site[1] = NULL;
+    if (word) {
+        op_rr(j, 8, 0x80, G_CMP, RCX);
+        emit(j, 0xff);
+        s->site[1] = jcc32(j, X_JE);
+    }
+    mov_rr(j, RDX, RCX);
+    shift_ri(j, G_SHR, RDX, 8);
+    op_mem(j, 64, X_LOAD, RDX, J_MAP, RDX, 3, offsetof(MemoryMap, write));
+    op_rr(j, 64, X_TEST, RDX, RDX);
+    s->site[0] = jcc32(j, X_JE);
+    op_rr(j, 32, X_MOVZX8, RCX, RCX);
+    if (word) op_mem(j, 16, X_MOV, RAX, RDX, RCX, 0, 0);
+    else op_mem(j, 8, 0x88, RAX, RDX, RCX, 0, 0);
+    s->resume = j->p;
+    s->helper = helper;
+    s->write = 1;
+    s->exit = exit;
+    s->exit_pc = next_pc;
+    s->exit_cycles = cycles;
+}
+
+//leave the block for pc, adding cycles. if link is set, the way out
+//starts with a jump that can be patched to go to the block at pc.
+static void emit_exit(Jit *j, uint16_t pc, int cycles, int link) {
+    byte *site = NULL;
+    if (cycles) alu_ri(j, G_ADD, J_CYCLES, cycles);
+    if (link) site = jmp32(j);
+    STATE_FIELD(16, 0xc7, 0, pc);
+    emit16(j, pc);
+    if (link) {
+        //lea rax, [rip + site]
+        emit(j, 0x48);
+        emit(j, 0x8d);
+        emit(j, 0x05);
+        emit32(j, site - (j->p + 4));
+        jmp_to(j, j->exit_link);
+    } else jmp_to(j, j->exit);
+}
+
+//go to the address in eax (cycles already added), through its block
+//if it has one
+static void emit_indirect(Jit *j) {
+    STATE_FIELD(16, X_MOV, RAX, pc);
+    mov_rr(j, RDX, RAX);
+    shift_ri(j, G_SHR, RDX, 8);
+    mov_ri64(j, RCX, j->entry);
+    op_mem(j, 64, X_LOAD, RCX, RCX, RDX, 3, 0);
+    op_rr(j, 64, X_TEST, RCX, RCX);
+    patch(jcc32(j, X_JE), j->exit);
+    op_rr(j, 32, X_MOVZX8, RDX, RAX);
+    op_mem(j, 64, X_LOAD, RCX, RCX, RDX, 3, 0);
+    op_rr(j, 64, X_TEST, RCX, RCX);
+    patch(jcc32(j, X_JE), j->exit);
+    op_rr(j, 32, 0xff, 4, RCX); //jmp rcx
+}
+
+//the slow paths of the block's memory accesses
+static void emit_slow_paths(Jit *j) {
+    for (int i = 0; i < j->nslow; i++) {
+        JitSlow *s = &j->slow[i];
+        patch(s->site[0], j->p);
+        if (s->site[1]) patch(s->site[1], j->p);
+        //r8-r10 hold 8080 state, and r11 keeps the stack aligned
+        push_r(j, R8);
+        push_r(j, R9);
+        push_r(j, R10);
+        push_r(j, R11);
+        op_rr(j, 64, X_MOV, J_STATE, RDI);
+        mov_rr(j, RSI, RCX);
+        if (s->write) mov_rr(j, RDX, RAX);
+        mov_ri64(j, RAX, s->helper);
+        op_rr(j, 32, 0xff, 2, RAX); //call rax
+        pop_r(j, R11);
+        pop_r(j, R10);
+        pop_r(j, R9);
+        pop_r(j, R8);
+        if (s->exit) {
+            op_rr(j, 32, X_TEST, RAX, RAX);
+            patch(jcc32(j, X_JE), s->resume);
+            emit_exit(j, s->exit_pc, s->exit_cycles, 0);
+        } else jmp_to(j, s->resume);
+    }
+    j->nslow = 0;
+}
+
+//what the flag word is known to hold in translated code
+enum { LF_UNKNOWN, LF_RESULT };
+
+//jump if condition cc (in the order of the Jcc opcodes) is false,
+//returning the rel32 to patch. after an instruction that leaves a
+//result in the flag word, zero, carry and sign can be tested in it
+//directly; otherwise the condition table is used.
+static byte *emit_cond_false(Jit *j, int cc, int lf_state) {
+    static const uint32_t mask[8] = {0xff, 0xff, 0x100, 0x100,
+                                     0, 0, 0x80, 0x80};
+    static const int false_jcc[8] = {X_JE, X_JNE, X_JNE, X_JE,
+                                     0, 0, X_JNE, X_JE};
+    if (lf_state == LF_RESULT && mask[cc]) {
+        test_ri(j, J_LF, mask[cc]);
+        return jcc32(j, false_jcc[cc]);
+    }
+    mov_rr(j, RAX, J_LF);
+    alu_ri(j, G_AND, RAX, 0x3ff);
+    mov_ri64(j, RDX, cond_table);
+    op_mem(j, 8, 0xf6, 0, RDX, RAX, 0, 0); //test byte [rdx + rax]
+    emit(j, 1 << cc);
+    return jcc32(j, X_JE);
+}
+
+//the flag word for the result in eax of an addition of ecx, or of a
+//subtraction (as an addition of ecx, the complement of the operand).
+//rdx is lost.
+static void emit_add_flags(Jit *j, int sub) {
+    mov_rr(j, RDX, J_A);
+    alu_rr(j, X_XOR, RDX, RCX);
+    alu_rr(j, X_XOR, RDX, RAX);
+    op_rr(j, 32, X_MOVZX8, RDX, RDX);
+    shift_ri(j, G_SHL, RDX, 16);
+    alu_rr(j, X_OR, RDX, RAX);
+    if (sub) alu_ri(j, G_XOR, RDX, LF_CY);
+    mov_rr(j, J_LF, RDX);
+}
+
+//carry from the flag word into reg, as 0 or 1
+static void emit_carry(Jit *j, int reg) {
+    mov_rr(j, reg, J_LF);
+    shift_ri(j, G_SHR, reg, 8);
+    alu_ri(j, G_AND, reg, 1);
+}
+
+//set the carry in the flag word to the 0 or 1 in reg, which is lost
+static void emit_set_carry(Jit *j, int reg) {
+    shift_ri(j, G_SHL, reg, 8);
+    alu_ri(j, G_AND, J_LF, ~LF_CY);
+    alu_rr(j, X_OR, J_LF, reg);
+}
+
+//accumulator arithmetic (kind in the order of the opcodes: ADD, ADC,
+//SUB, SBB, ANA, XRA, ORA, CMP) on the operand in ecx
+static void emit_alu(Jit *j, int kind, int live) {
+    switch (kind) {
+        case 0: case 1:
+            mov_rr(j, RAX, J_A);
+            alu_rr(j, X_ADD, RAX, RCX);
+            if (kind == 1) {
+                emit_carry(j, RDX);
+                alu_rr(j, X_ADD, RAX, RDX);
             }
-            st.opbytes = 3;
+            if (live) emit_add_flags(j, 0);
+            op_rr(j, 32, X_MOVZX8, J_A, RAX);
             break;
-        }
-        //MVI
-        case 0x06: case 0x0e: case 0x16: case 0x1e:
-        case 0x26: case 0x2e: case 0x36: case 0x3e:
-        {            
-            st.opcycles = 7;
-            int dsttype = (*opcode - 0x06) / 0x08;
-            if (dsttype < 6) {
-                state->reg[dsttype + 1] = opcode[1];
-            } else if (dsttype == 6) {
-                st.opcycles = 10;
-                uint16_t mem_adr = state->reg[5] << 8 | state->reg[6];
-                state->memory[mem_adr] = opcode[1];
-            } else {
-                state->reg[0] = opcode[1];
-            }
-            st.opbytes = 2;
+        case 2: case 3: case 7:
+            alu_ri(j, G_XOR, RCX, 0xff);
+            mov_rr(j, RAX, J_A);
+            alu_rr(j, X_ADD, RAX, RCX);
+            if (kind == 3) {
+                emit_carry(j, RDX);
+                alu_ri(j, G_XOR, RDX, 1);
+                alu_rr(j, X_ADD, RAX, RDX);
+            } else alu_ri(j, G_ADD, RAX, 1);
+            if (live) emit_add_flags(j, 1);
+            if (kind != 7) op_rr(j, 32, X_MOVZX8, J_A, RAX);
             break;
-        }
-        //STA
-        case 0x32:
-        {
-            st.opcycles = 13;
-            uint16_t mem_adr = opcode[2] << 8 | opcode[1];
-            if (mem_adr > state->mem_size - 1) {
-                fprintf(stderr, "Address past end of memory for STA!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
+        case 4:
+            mov_rr(j, RAX, J_A);
+            alu_rr(j, X_AND, RAX, RCX);
+            if (live) {
+                //aux carry is bit 3 of either operand
+                mov_rr(j, RDX, J_A);
+                alu_rr(j, X_OR, RDX, RCX);
+                shift_ri(j, G_SHL, RDX, 1);
+                op_rr(j, 32, X_MOVZX8, RDX, RDX);
+                shift_ri(j, G_SHL, RDX, 16);
+                alu_rr(j, X_OR, RDX, RAX);
+                mov_rr(j, J_LF, RDX);
             }
-            state->memory[mem_adr] = state->reg[0];
-            st.opbytes = 3;
+            mov_rr(j, J_A, RAX);
             break;
-        }
-        //LDA
-        case 0x3a:
-        {
-            st.opcycles = 13;
-            uint16_t mem_adr = opcode[2] << 8 | opcode[1];
-            if (mem_adr > state->mem_size - 1) {
-                fprintf(stderr, "Address past end of memory for LDA!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
-            }
-            state->reg[0] = state->memory[mem_adr];
-            st.opbytes = 3;
+        case 5: case 6:
+            alu_rr(j, kind == 5 ? X_XOR : X_OR, J_A, RCX);
+            if (live) mov_rr(j, J_LF, J_A);
             break;
-        }
-        //SHLD
-        case 0x22:
+    }
+}
+
+//INR (or DCR) of the value in eax, which is left with the result
+static void emit_inr_dcr(Jit *j, int dcr, int live) {
+    mov_rr(j, RCX, RAX);
+    alu_ri(j, dcr ? G_SUB : G_ADD, RAX, 1);
+    op_rr(j, 32, X_MOVZX8, RAX, RAX);
+    if (live) {
+        mov_rr(j, RDX, RCX);
+        alu_rr(j, X_XOR, RDX, RAX);
+        if (dcr) alu_ri(j, G_XOR, RDX, 0x10);
+        shift_ri(j, G_SHL, RDX, 16);
+        alu_ri(j, G_AND, J_LF, LF_CY);
+        alu_rr(j, X_OR, J_LF, RAX);
+        alu_rr(j, X_OR, J_LF, RDX);
+    }
+}
+
+//push the value in eax
+static void emit_push(Jit *j, int exit, uint16_t next_pc, int cycles) {
+    op_rr(j, 16, 0x83, G_SUB, J_SP);
+    emit(j, 2);
+    mov_rr(j, RCX, J_SP);
+    emit_write(j, 1, (void *) jit_push16, exit, next_pc, cycles);
+}
+
+//pop into eax
+static void emit_pop(Jit *j) {
+    mov_rr(j, RCX, J_SP);
+    emit_read(j, 1);
+    op_rr(j, 16, 0x83, G_ADD, J_SP);
+    emit(j, 2);
+}
+
+//translate one instruction at pc, taken after cycles cycles of the
+//block. live is whether anything reads the flags it sets (if not, the
+//flag word is left as it was).
+static void jit_op(Jit *j, byte *ins, uint16_t pc, int cycles, int live,
+                   int *lf_state) {
+    byte op = ins[0];
+    uint16_t imm = ins[2] << 8 | ins[1];
+    uint16_t next = pc + oplen[op];
+    int done = cycles + opcycles[op];
+    int r = op >> 3 & 7, src = op & 7, pair = pair_reg[op >> 4 & 3];
+
+    //MOV, and the accumulator arithmetic on registers and memory
+    if (op >= 0x40 && op < 0x80) {
+        if (r == src) return;
+        if (src == 6) {
+            mov_rr(j, RCX, J_HL);
+            emit_read(j, 0);
+        } else get_reg(j, src, RAX);
+        if (r == 6) {
+            mov_rr(j, RCX, J_HL);
+            emit_write(j, 0, (void *) jit_write8, 1, next, done);
+        } else set_reg(j, r, RAX);
+        return;
+    }
+    if (op >= 0x80 && op < 0xc0) {
+        if (src == 6) {
+            mov_rr(j, RCX, J_HL);
+            emit_read(j, 0);
+            mov_rr(j, RCX, RAX);
+        } else get_reg(j, src, RCX);
+        emit_alu(j, r, live);
+        if (live) *lf_state = LF_RESULT;
+        return;
+    }
+
+    switch (op & 0xc7) {
+        case 0x04: case 0x05: //INR, DCR
+            if (r == 6) {
+                mov_rr(j, RCX, J_HL);
+                emit_read(j, 0);
+            } else get_reg(j, r, RAX);
+            emit_inr_dcr(j, op & 1, live);
+            if (live) *lf_state = LF_RESULT;
+            if (r == 6) {
+                mov_rr(j, RCX, J_HL);
+                emit_write(j, 0, (void *) jit_write8, 1, next, done);
+            } else set_reg(j, r, RAX);
+            return;
+        case 0x06: //MVI
+            mov_ri(j, RAX, ins[1]);
+            if (r == 6) {
+                mov_rr(j, RCX, J_HL);
+                emit_write(j, 0, (void *) jit_write8, 1, next, done);
+            } else set_reg(j, r, RAX);
+            return;
+        case 0xc6: //ADI, ACI, SUI, SBI, ANI, XRI, ORI, CPI
+            mov_ri(j, RCX, ins[1]);
+            emit_alu(j, r, live);
+            if (live) *lf_state = LF_RESULT;
+            return;
+        case 0xc2: //Jcc
         {
-            st.opcycles = 16;
-            uint16_t mem_adr = opcode[2] << 8 | opcode[1];
-            if (mem_adr > state->mem_size - 2) {
-                fprintf(stderr, "Address past end of memory for SHLD!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
-            }
-            state->memory[mem_adr] = state->reg[6];
-            state->memory[mem_adr + 1] = state->reg[5];
-            st.opbytes = 3;
-            break;
+            byte *skip = emit_cond_false(j, r, *lf_state);
+            emit_exit(j, imm, done, 1);
+            patch(skip, j->p);
+            emit_exit(j, next, done, 1);
+            return;
         }
-        //LHLD
-        case 0x2a:
+        case 0xc4: //Ccc
         {
-            st.opcycles = 16;
-            uint16_t mem_adr = opcode[2] << 8 | opcode[1];
-            if (mem_adr > state->mem_size - 2) {
-                fprintf(stderr, "Address past end of memory for LHLD!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
-            }
-            state->reg[6] = state->memory[mem_adr];
-            state->reg[5] = state->memory[mem_adr + 1];
-            st.opbytes = 3;
-            break;
+            byte *skip = emit_cond_false(j, r, *lf_state);
+            mov_ri(j, RAX, next);
+            emit_push(j, 0, 0, 0);
+            emit_exit(j, imm, cycles + optaken[op], 1);
+            patch(skip, j->p);
+            emit_exit(j, next, done, 1);
+            return;
         }
-        //PCHL
-        case 0xe9:
+        case 0xc0: //Rcc
         {
-            st.opcycles = 5;
-            uint16_t mem_adr = state->reg[5] << 8 | state->reg[6];
-            if (mem_adr > state->mem_size - 1) {
-                fprintf(stderr, "PCHL jump to invalid address!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
-            }
-            state->pc = mem_adr;
-            st.opbytes = 0;
-            break;
+            byte *skip = emit_cond_false(j, r, *lf_state);
+            emit_pop(j);
+            alu_ri(j, G_ADD, J_CYCLES, cycles + optaken[op]);
+            emit_indirect(j);
+            patch(skip, j->p);
+            emit_exit(j, next, done, 1);
+            return;
         }
-        //JMP
-        case 0xc3:
-        {
-            st.opcycles = 10;
-            st.opbytes = 0;
-            int failure = jump_if(1, opcode[2] << 8 | opcode[1], state);
-            if (failure) {
-                fprintf(stderr, "JMP to invalid address!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
+        case 0xc7: //RST
+            mov_ri(j, RAX, next);
+            emit_push(j, 0, 0, 0);
+            emit_exit(j, r * 8, done, 1);
+            return;
+    }
+
+    switch (op & 0xcf) {
+        case 0x01: //LXI
+            mov_ri(j, pair, imm);
+            return;
+        case 0x03: case 0x0b: //INX, DCX
+            op_rr(j, 16, 0xff, op >> 3 & 1, pair);
+            return;
+        case 0x09: //DAD
+            mov_rr(j, RAX, J_HL);
+            alu_rr(j, X_ADD, RAX, pair);
+            if (live) {
+                mov_rr(j, RDX, RAX);
+                shift_ri(j, G_SHR, RDX, 16);
+                emit_set_carry(j, RDX);
             }
-            break;
-        }
-        //JNZ, JZ, JNC, JC, JPO, JPE, JP, JM
-        case 0xc2: case 0xca: case 0xd2: case 0xda:
-        case 0xe2: case 0xea: case 0xf2: case 0xfa:
-        {
-            st.opcycles = 10;
-            int cflags[4] = {state->fl.z, state->fl.cy,
-                             state->fl.p, state->fl.s};
-            int ftype = (*opcode - 0xc2) / 0x10;
-            int positive = (*opcode - 0xc2) % 0x10 > 0;
-            int flag = cflags[ftype];
-            flag = positive ? flag : !flag;
-            st.opbytes = flag ? 0 : 3;
-            int failure = jump_if(flag, opcode[2] << 8 | opcode[1], state);
-            if (failure) {
-                static const char freprs[8][3] =
-                                        {"NZ", "Z", "NC", "C",
-                                         "PO", "PE", "P", "M"};
-                fprintf(stderr, "J%s to invalid address!\n",
-                    freprs[(*opcode - 0xc2)/0x08]);
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
+            op_rr(j, 32, X_MOVZX16, J_HL, RAX);
+            return;
+        case 0xc1: //POP
+            emit_pop(j);
+            if (op != 0xf1) {
+                mov_rr(j, pair, RAX);
+                return;
             }
-            break;
-        }
-        //CALL
-        case 0xcd:
-        {
-            st.opcycles = 17;
-            st.opbytes = 0;
-            //push return address to stack
-            if (state->sp < 2) {
-                fprintf(stderr, "Stack overflow on CALL!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
+            //POP PSW: the flag word for flags set directly
+            mov_rr(j, J_A, RAX);
+            shift_ri(j, G_SHR, J_A, 8);
+            if (live) {
+                op_rr(j, 32, X_MOVZX8, RAX, RAX);
+                mov_rr(j, J_LF, RAX);
+                alu_ri(j, G_OR, J_LF, LF_PSW);
+                mov_rr(j, RDX, RAX);
+                alu_ri(j, G_AND, RDX, 0x01);
+                shift_ri(j, G_SHL, RDX, 8);
+                alu_rr(j, X_OR, J_LF, RDX);
+                alu_ri(j, G_AND, RAX, 0x10);
+                shift_ri(j, G_SHL, RAX, 16);
+                alu_rr(j, X_OR, J_LF, RAX);
             }
-            state->sp -= 2;
-            uint16_t ret_adr = state->pc + 3;
-            state->memory[state->sp + 1] = ret_adr >> 8;
-            state->memory[state->sp] = ret_adr & 0xff;
-            //jump
-            int failure = jump_if(1, opcode[2] << 8 | opcode[1], state);
-            if (failure) {
-                fprintf(stderr, "CALL to invalid address!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
+            *lf_state = LF_UNKNOWN;
+            return;
+        case 0xc5: //PUSH
+            if (op != 0xf5) mov_rr(j, RAX, pair);
+            else {
+                //PUSH PSW: A, then the PSW byte from the flag word
+                mov_rr(j, RAX, J_LF);
+                alu_ri(j, G_AND, RAX, 0x3ff);
+                mov_ri64(j, RDX, psw_table);
+                op_mem(j, 32, X_MOVZX8, RAX, RDX, RAX, 0, 0);
+                mov_rr(j, RDX, J_LF);
+                shift_ri(j, G_SHR, RDX, 16);
+                alu_ri(j, G_AND, RDX, 0x10);
+                alu_rr(j, X_OR, RAX, RDX);
+                mov_rr(j, RDX, J_A);
+                shift_ri(j, G_SHL, RDX, 8);
+                alu_rr(j, X_OR, RAX, RDX);
             }
-            break;
-        }
-        //CNZ, CZ, CNC, CC, CPO, CPE, CP, CM
-        case 0xc4: case 0xcc: case 0xd4: case 0xdc:
-        case 0xe4: case 0xec: case 0xf4: case 0xfc:
-        {
-            st.opcycles = 11;
-            int cflags[4] = {state->fl.z, state->fl.cy,
-                             state->fl.p, state->fl.s};
-            int ftype = (*opcode - 0xc4) / 0x10;
-            int positive = (*opcode - 0xc4) % 0x10 > 0;
-            int flag = cflags[ftype];
-            flag = positive ? flag : !flag;
-            st.opbytes = flag ? 0 : 3;
-            if (flag) {
-                st.opcycles = 17;
-                //push return address to stack
-                if (state->sp < 2) {
-                    fprintf(stderr, "Stack overflow on CALL!\n");
-                    fprintf(stderr, "Program counter is %04x\n", state->pc);
-                    exit(1);
-                }
-                state->sp -= 2;
-                uint16_t ret_adr = state->pc + 3;
-                state->memory[state->sp + 1] = ret_adr >> 8;
-                state->memory[state->sp] = ret_adr & 0xff;
+            emit_push(j, 1, next, done);
+            return;
+    }
+
+    switch (op) {
+        case 0x02: case 0x12: //STAX
+            mov_rr(j, RCX, pair);
+            mov_rr(j, RAX, J_A);
+            emit_write(j, 0, (void *) jit_write8, 1, next, done);
+            return;
+        case 0x0a: case 0x1a: //LDAX
+            mov_rr(j, RCX, pair);
+            emit_read(j, 0);
+            mov_rr(j, J_A, RAX);
+            return;
+        case 0x22: //SHLD
+            mov_ri(j, RCX, imm);
+            mov_rr(j, RAX, J_HL);
+            emit_write(j, 1, (void *) jit_write16, 1, next, done);
+            return;
+        case 0x2a: //LHLD
+            mov_ri(j, RCX, imm);
+            emit_read(j, 1);
+            mov_rr(j, J_HL, RAX);
+            return;
+        case 0x32: //STA
+            mov_ri(j, RCX, imm);
+            mov_rr(j, RAX, J_A);
+            emit_write(j, 0, (void *) jit_write8, 1, next, done);
+            return;
+        case 0x3a: //LDA
+            mov_ri(j, RCX, imm);
+            emit_read(j, 0);
+            mov_rr(j, J_A, RAX);
+            return;
+        case 0x07: //RLC
+            op_rr(j, 8, 0xd0, G_ROL, J_A);
+            if (live) {
+                mov_rr(j, RAX, J_A);
+                alu_ri(j, G_AND, RAX, 1);
+                emit_set_carry(j, RAX);
             }
-            int failure = jump_if(flag, opcode[2] << 8 | opcode[1], state);
-            if (failure) {
-                static const char freprs[8][3] =
-                                        {"NZ", "Z", "NC", "C",
-                                         "PO", "PE", "P", "M"};
-                fprintf(stderr, "C%s to invalid address!\n",
-                    freprs[(*opcode - 0xc4)/0x08]);
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
+            return;
+        case 0x0f: //RRC
+            op_rr(j, 8, 0xd0, G_ROR, J_A);
+            if (live) {
+                mov_rr(j, RAX, J_A);
+                shift_ri(j, G_SHR, RAX, 7);
+                emit_set_carry(j, RAX);
             }
-            break;
+            return;
+        case 0x17: //RAL
+            emit_carry(j, RAX);
+            mov_rr(j, RDX, J_A);
+            shift_ri(j, G_SHR, RDX, 7);
+            shift_ri(j, G_SHL, J_A, 1);
+            alu_rr(j, X_OR, J_A, RAX);
+            op_rr(j, 32, X_MOVZX8, J_A, J_A);
+            if (live) emit_set_carry(j, RDX);
+            return;
+        case 0x1f: //RAR
+            emit_carry(j, RAX);
+            shift_ri(j, G_SHL, RAX, 7);
+            mov_rr(j, RDX, J_A);
+            alu_ri(j, G_AND, RDX, 1);
+            shift_ri(j, G_SHR, J_A, 1);
+            alu_rr(j, X_OR, J_A, RAX);
+            if (live) emit_set_carry(j, RDX);
+            return;
+        case 0x2f: //CMA
+            alu_ri(j, G_XOR, J_A, 0xff);
+            return;
+        case 0x37: //STC
+            if (live) alu_ri(j, G_OR, J_LF, LF_CY);
+            return;
+        case 0x3f: //CMC
+            if (live) alu_ri(j, G_XOR, J_LF, LF_CY);
+            return;
+        case 0xc3: //JMP
+            emit_exit(j, imm, done, 1);
+            return;
+        case 0xcd: //CALL
+            mov_ri(j, RAX, next);
+            emit_push(j, 0, 0, 0);
+            emit_exit(j, imm, done, 1);
+            return;
+        case 0xc9: //RET
+            emit_pop(j);
+            alu_ri(j, G_ADD, J_CYCLES, done);
+            emit_indirect(j);
+            return;
+        case 0xe9: //PCHL
+            mov_rr(j, RAX, J_HL);
+            alu_ri(j, G_ADD, J_CYCLES, done);
+            emit_indirect(j);
+            return;
+        case 0xe3: //XTHL
+            emit_pop(j);
+            op_rr(j, 16, 0x83, G_SUB, J_SP);
+            emit(j, 2);
+            mov_rr(j, R11, RAX);
+            mov_rr(j, RAX, J_HL);
+            mov_rr(j, J_HL, R11);
+            mov_rr(j, RCX, J_SP);
+            emit_write(j, 1, (void *) jit_write16, 1, next, done);
+            return;
+        case 0xeb: //XCHG
+            op_rr(j, 32, X_XCHG, R14, R15);
+            return;
+        case 0xf9: //SPHL
+            mov_rr(j, J_SP, J_HL);
+            return;
+        case 0xdb: { //IN
+            JitSlow *s = emit_port(j, ins[1], offsetof(MemoryMap, in),
+                                   (void *) jit_in, 0);
+            op_mem(j, 32, X_MOVZX8, RAX, J_STATE, -1, 0,
+                   offsetof(CPUState, ports) + ins[1]);
+            s->resume = j->p;
+            mov_rr(j, J_A, RAX);
+            return;
         }
-        //RET
-        case 0xc9:
-        {
-            st.opcycles = 10;
-            st.opbytes = 0;
-            if (state->sp > state->mem_size - 2) {
-                fprintf(stderr, "Stack underflow on RET!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
-            }
-            uint16_t mem_adr = state->memory[state->sp + 1] << 8 |
-                                state->memory[state->sp];
-            state->sp += 2;
-            if (mem_adr >= state->mem_size) {
-                fprintf(stderr, "RET to invalid address!\n");
-                fprintf(stderr, "Program counter at 0x%04x\n", state->pc);
-                exit(1);
-            }
-            state->pc = mem_adr;
-            break;
+        case 0xd3: { //OUT
+            JitSlow *s = emit_port(j, ins[1], offsetof(MemoryMap, out),
+                                   (void *) jit_out, 1);
+            op_mem(j, 8, 0x88, J_A, J_STATE, -1, 0,
+                   offsetof(CPUState, ports) + ins[1]);
+            STATE_FIELD(32, 0xc7, 0, write_flag);
+            emit32(j, ins[1]);
+            emit_exit(j, next, done, 0);
+            //the handler doesn't stop runCPU, so this way out is linked
+            s->resume = j->p;
+            emit_exit(j, next, done, 1);
+            return;
         }
-        //RNZ, RZ, RNC, RC, RPO, RPE, RP, RM
-        case 0xc0: case 0xc8: case 0xd0: case 0xd8:
-        case 0xe0: case 0xe8: case 0xf0: case 0xf8:
-        {
-            st.opcycles = 5;
-            int cflags[4] = {state->fl.z, state->fl.cy,
-                             state->fl.p, state->fl.s};
-            int ftype = (*opcode - 0xc0) / 0x10;
-            int positive = (*opcode - 0xc0) % 0x10 > 0;
-            int flag = cflags[ftype];
-            flag = positive ? flag : !flag;
-            st.opbytes = flag ? 0 : 1;
-            if (flag) {
-                st.opcycles = 11;
-                //pop return address off stack
-                if (state->sp > state->mem_size - 2) {
-                    fprintf(stderr, "Stack underflow on RET!\n");
-                    fprintf(stderr, "Program counter is %04x\n", state->pc);
-                    exit(1);
-                }
-                uint16_t mem_adr = state->memory[state->sp + 1] << 8 |
-                                    state->memory[state->sp];
-                state->sp += 2;
-                
-                if (mem_adr >= state->mem_size) {
-                    static const char freprs[8][3] =
-                                            {"NZ", "Z", "NC", "C",
-                                             "PO", "PE", "P", "M"};
-                    fprintf(stderr, "R%s to invalid address!\n",
-                        freprs[(*opcode - 0xc0)/0x08]);
-                    fprintf(stderr, "Program counter is %04x\n", state->pc);
-                    exit(1);
-                }
-                state->pc = mem_adr;
+        case 0xf3: case 0xfb: //DI, EI
+            STATE_FIELD(8, 0xc6, 0, int_enable);
+            emit(j, op == 0xfb);
+            return;
+    }
+    //what's left are the NOPs
+}
+
+//the code that goes into and out of translated code
+static void jit_emit_trampoline(Jit *j) {
+    static const int saved[] = {RBX, RBP, R12, R13, R14, R15, R8, RCX};
+    j->enter = (int (*)(CPUState *, byte *, int, int, byte **)) j->p;
+    //the budget ends up at [rsp + 8] and site at [rsp + 16], with the
+    //stack aligned for calls
+    for (int i = 0; i < 8; i++) push_r(j, saved[i]);
+    op_rr(j, 64, 0x83, G_SUB, RSP);
+    emit(j, 8);
+    op_rr(j, 64, X_MOV, RDI, J_STATE);
+    STATE_FIELD(64, X_LOAD, J_MAP, map);
+    STATE_FIELD(32, X_MOVZX8, J_A, a);
+    STATE_FIELD(32, X_MOVZX16, R13, bc);
+    STATE_FIELD(32, X_MOVZX16, R14, de);
+    STATE_FIELD(32, X_MOVZX16, R15, hl);
+    STATE_FIELD(32, X_MOVZX16, J_SP, sp);
+    STATE_FIELD(32, X_LOAD, J_LF, lf);
+    mov_rr(j, J_CYCLES, RDX);
+    op_rr(j, 32, 0xff, 4, RSI); //jmp rsi
+
+    j->exit = j->p;
+    alu_rr(j, X_XOR, RAX, RAX);
+    j->exit_link = j->p;
+    op_mem(j, 64, X_LOAD, RCX, RSP, -1, 0, 16);
+    op_mem(j, 64, X_MOV, RAX, RCX, -1, 0, 0);
+    STATE_FIELD(8, 0x88, J_A, a);
+    STATE_FIELD(16, X_MOV, R13, bc);
+    STATE_FIELD(16, X_MOV, R14, de);
+    STATE_FIELD(16, X_MOV, R15, hl);
+    STATE_FIELD(16, X_MOV, J_SP, sp);
+    STATE_FIELD(32, X_MOV, J_LF, lf);
+    mov_rr(j, RAX, J_CYCLES);
+    op_rr(j, 64, 0x83, G_ADD, RSP);
+    emit(j, 8);
+    for (int i = 7; i >= 0; i--) pop_r(j, saved[i]);
+    emit(j, 0xc3); //ret
+    j->code = j->p;
+}
+
+//drop all translated code
+static void jit_flush(Jit *j, DecodeCache *dc) {
+    for (int page = 0; page < 256; page++) {
+        free(j->entry[page]);
+        j->entry[page] = NULL;
+        j->page_blocks[page] = -1;
+    }
+    for (int i = 0; i < dc->ncode; i++) {
+        DecodedOp *ops = dc->ops[dc->code_pages[i]];
+        if (dc->shared_hits[dc->code_pages[i]]) continue;
+        for (int k = 0; k < PAGE_SIZE; k++) ops[k].in_block = 0;
+    }
+    j->p = j->code;
+    j->nblocks = 0;
+    j->nlinks = 0;
+    j->flushes++;
+}
+
+//drop the blocks on a page, and unpatch the jumps into them
+static void jit_drop_page(Jit *j, int page) {
+    for (int i = j->page_blocks[page]; i >= 0; i = j->blocks[i].next) {
+        j->entry[page][j->blocks[i].start & 0xff] = NULL;
+        for (int l = j->blocks[i].links; l >= 0; l = j->links[l].next)
+            memset(j->links[l].site, 0, 4);
+    }
+    j->page_blocks[page] = -1;
+}
+
+static void jit_destroy(Jit *j) {
+    for (int page = 0; page < 256; page++) free(j->entry[page]);
+    munmap(j->buf, JIT_BUFFER_SIZE);
+    free(j);
+}
+
+//translate the block at pc, returning its code (or NULL if the first
+//instruction can't be translated)
+static byte *jit_translate(CPUState *state, uint16_t pc) {
+    DecodeCache *dc = state->decoded;
+    Jit *j = dc->jit;
+    DecodedOp *ops[BLOCK_MAX_OPS];
+    int live[BLOCK_MAX_OPS];
+    int page = pc >> 8;
+
+    if (j->end - j->p < (BLOCK_MAX_OPS + 1) * JIT_MAX_OP_CODE ||
+        j->nblocks == JIT_MAX_BLOCKS)
+        jit_flush(j, dc);
+
+    //the instructions in the block, up to a DAA
+    int n = find_block(state, pc, ops);
+    for (int i = 0; i < n; i++)
+        if (ops[i]->bytes[0] == 0x27) n = i;
+    if (n == 0) return NULL;
+
+    //which of them set flags that something reads
+    flags_live(ops, n, live);
+    for (int i = 0; i < n; i++)
+        live[i] = (live[i] & flags_written[ops[i]->bytes[0]]) != 0;
+
+    //runCPU stops after the instruction that uses up the budget, so
+    //the block can only be run if it has some left after all but its
+    //last instruction. if not, leave without running any of it.
+    int before_last = 0;
+    for (int i = 0; i < n - 1; i++) before_last += ops[i]->cycles;
+    byte *entry = j->p;
+    op_mem(j, 32, 0x8d, RAX, J_CYCLES, -1, 0, before_last); //lea
+    op_mem(j, 32, 0x3b, RAX, RSP, -1, 0, 8); //cmp eax, [rsp + 8]
+    byte *body = jcc32(j, X_JL);
+    emit_exit(j, pc, 0, 0);
+    patch(body, j->p);
+
+    int cycles = 0, lf_state = LF_UNKNOWN;
+    uint16_t adr = pc;
+    for (int i = 0; i < n; i++) {
+        jit_op(j, ops[i]->bytes, adr, cycles, live[i], &lf_state);
+        cycles += ops[i]->cycles;
+        adr += ops[i]->len;
+        if (!dc->shared_hits[page]) ops[i]->in_block = 1;
+    }
+    if (!ends_block(ops[n - 1]->bytes[0])) emit_exit(j, adr, cycles, 1);
+    emit_slow_paths(j);
+
+    if (!j->entry[page]) j->entry[page] = calloc(PAGE_SIZE, sizeof(byte *));
+    j->entry[page][pc & 0xff] = entry;
+    j->blocks[j->nblocks] = (JitBlock) {pc, j->page_blocks[page], -1};
+    j->page_blocks[page] = j->nblocks++;
+    return entry;
+}
+
+//patch the jump at site to go to the block at pc
+static void jit_link(Jit *j, byte *site, uint16_t pc, byte *entry) {
+    int i = j->page_blocks[pc >> 8];
+    while (i >= 0 && j->blocks[i].start != pc) i = j->blocks[i].next;
+    if (i < 0 || j->nlinks == JIT_MAX_LINKS) return;
+    patch(site, entry);
+    j->links[j->nlinks] = (JitLink) {site, j->blocks[i].links};
+    j->blocks[i].links = j->nlinks++;
+}
+
+//runCPU with the JIT on. anything that isn't translated yet is run by
+//the handlers, one instruction at a time.
+static NOINLINE int run_jit(CPUState *cs, int cycle_budget) {
+    DecodeCache *dc = cs->decoded;
+    Jit *j = dc->jit;
+    int cycles = 0;
+    byte *site = NULL;
+    unsigned flushes = j->flushes;
+    cs->write_flag = -1;
+    cs->trap = TRAP_NONE;
+    cs->lf = lazyFlags(cs->fl);
+    while (cycles < cycle_budget) {
+        byte **page = j->entry[cs->pc >> 8];
+        byte *entry = page ? page[cs->pc & 0xff] : NULL;
+        DecodedOp *d = NULL;
+        if (!entry) {
+            d = decoded_at(cs, cs->pc);
+            if (d != &dc->uncached &&
+                ++*hits_at(dc, d, cs->pc) >= JIT_THRESHOLD) {
+                entry = jit_translate(cs, cs->pc);
+                if (!entry) *hits_at(dc, d, cs->pc) = 0;
             }
-            break;
         }
-        //RST 0-7
-        case 0xc7: case 0xcf: case 0xd7: case 0xdf:
-        case 0xe7: case 0xef: case 0xf7: case 0xff:
-        {
-            st.opcycles = 11;
-            st.opbytes = 0;
-            uint16_t rst_adr = (*opcode - 0xc7);
-            //push return address onto stack and jump to
-            //specified ISR
-            uint16_t ret_adr = state->pc + 1;
-            if (state->sp < 2) {
-                fprintf(stderr, "Stack overflow on RST!\n");
-                fprintf(stderr, "Program counter is %04x\n", state->pc);
-                exit(1);
-            }
-            state->sp -= 2;
-            state->memory[state->sp] = ret_adr & 0xff;
-            state->memory[state->sp + 1] = ret_adr >> 8;
-            state->pc = rst_adr;
-            break;
+        if (entry) {
+            int before = cycles;
+            if (site && flushes == j->flushes)
+                jit_link(j, site, cs->pc, entry);
+            flushes = j->flushes;
+            site = NULL;
+            cycles = j->enter(cs, entry, cycles, cycle_budget, &site);
+            if (cs->write_flag >= 0) break;
+            if (cycles != before) continue;
+            //the block would run past the budget, so step up to it
+            d = decoded_at(cs, cs->pc);
         }
-        //EI, DI
-        case 0xf3: case 0xfb:
-        {
-            st.opcycles = 4;
-            state->int_enable = (*opcode - 0xf3)/8;
-            break;
+        site = NULL;
+        OpStats st = d->handler(cs, d->bytes);
+        cs->pc += st.opbytes;
+        cycles += st.opcycles;
+        if (st.opcycles == 0 || cs->halted || cs->write_flag >= 0) break;
+    }
+    cs->fl = flagsView(cs->lf);
+    return cycles;
+}
+
+#endif
+
+int enableJIT(CPUState *cs) {
+#ifdef JIT_X86_64
+    enableDecodeCache(cs);
+    if (cs->decoded->jit) return 1;
+    Jit *j = calloc(1, sizeof(Jit));
+    j->buf = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (j->buf == MAP_FAILED) {
+        free(j);
+        return 0;
+    }
+    j->p = j->buf;
+    j->end = j->buf + JIT_BUFFER_SIZE;
+    for (int page = 0; page < 256; page++) j->page_blocks[page] = -1;
+    jit_emit_trampoline(j);
+    cs->decoded->jit = j;
+    return 1;
+#else
+    (void) cs;
+    return 0;
+#endif
+}
+
+/*
+    Saved decode caches. saveDecodeCache writes out one record for each
+    instruction in the decode cache: where it is, how long it is, how
+    often runCPU has reached it and whether a block was translated from
+    it. The file starts with a hash of the bytes of those instructions,
+    and loadDecodeCache only uses it if memory holds the same bytes
+    now. It decodes each instruction again, through the decode cache's
+    usual path (so guest writes drop them as they would any others),
+    and translates the blocks again with whichever of threaded blocks
+    and the JIT is on, so a program starts out running as fast as it
+    finished last time.
+*/
+#define SAVED_MAGIC 0x38303830 //"8080", which also tells the byte order
+#define SAVED_VERSION 1
+
+typedef struct SavedHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nops;
+    uint32_t hash; //of the bytes of the instructions, in order
+} SavedHeader;
+
+typedef struct SavedOp {
+    uint16_t pc;
+    byte len;
+    byte hits;
+    byte block; //set if a block was translated from it
+    byte pad[3];
+} SavedOp;
+
+//FNV-1a, over the bytes of each instruction as the CPU reads them
+static uint32_t saved_hash(CPUState *state, const SavedOp *ops, int n) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < n; i++)
+        for (int k = 0; k < ops[i].len; k++)
+            h = (h ^ read_byte(state, ops[i].pc + k)) * 16777619u;
+    return h;
+}
+
+//whether a block was translated from the decoded instruction at pc
+static int saved_block(DecodeCache *dc, DecodedOp *d, uint16_t pc) {
+#ifdef JIT_X86_64
+    if (dc->jit)
+        return dc->jit->entry[pc >> 8] &&
+               dc->jit->entry[pc >> 8][pc & 0xff];
+#else
+    (void) dc;
+    (void) pc;
+#endif
+    return d->block != NULL;
+}
+
+int saveDecodeCache(CPUState *cs, const char *path) {
+    DecodeCache *dc = cs->decoded;
+    SavedOp *ops = malloc(ADDRESS_SPACE * sizeof(SavedOp));
+    int n = 0;
+    for (int i = 0; dc && i < dc->ncode; i++) {
+        int page = dc->code_pages[i];
+        for (int k = 0; k < PAGE_SIZE; k++) {
+            DecodedOp *d = &dc->ops[page][k];
+            uint16_t pc = page << 8 | k;
+            if (!d->handler) continue;
+            ops[n++] = (SavedOp) {pc, d->len, *hits_at(dc, d, pc),
+                                  saved_block(dc, d, pc), {0}};
         }
-        //IN
-        case 0xdb:
-        {
-            st.opbytes = 2;
-            st.opcycles = 10;
-            byte port = opcode[1];
-            state->reg[0] = state->ports[port];
-            break;
+    }
+    SavedHeader h = {SAVED_MAGIC, SAVED_VERSION, n, saved_hash(cs, ops, n)};
+    FILE *f = fopen(path, "wb");
+    int ok = f && fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(ops, sizeof(SavedOp), n, f) == (size_t) n;
+    if (f && fclose(f) != 0) ok = 0;
+    free(ops);
+    return ok;
+}
+
+int loadDecodeCache(CPUState *cs, const char *path) {
+    SavedHeader h;
+    SavedOp *ops = NULL;
+    FILE *f = fopen(path, "rb");
+    int ok = f && fread(&h, sizeof(h), 1, f) == 1 &&
+             h.magic == SAVED_MAGIC && h.version == SAVED_VERSION &&
+             h.nops <= ADDRESS_SPACE;
+    if (ok) {
+        ops = malloc(h.nops * sizeof(SavedOp));
+        ok = fread(ops, sizeof(SavedOp), h.nops, f) == h.nops;
+    }
+    if (f) fclose(f);
+    //every instruction has to be the one that was saved
+    for (uint32_t i = 0; ok && i < h.nops; i++)
+        ok = ops[i].len == oplen[read_byte(cs, ops[i].pc)];
+    if (ok) ok = saved_hash(cs, ops, h.nops) == h.hash;
+    if (!ok) {
+        free(ops);
+        return 0;
+    }
+
+    enableDecodeCache(cs);
+    DecodeCache *dc = cs->decoded;
+    for (uint32_t i = 0; i < h.nops; i++) {
+        DecodedOp *d = decoded_at(cs, ops[i].pc);
+        if (d != &dc->uncached) *hits_at(dc, d, ops[i].pc) = ops[i].hits;
+    }
+    for (uint32_t i = 0; i < h.nops; i++) {
+        uint16_t pc = ops[i].pc;
+        DecodedOp *d = decoded_at(cs, pc);
+        if (!ops[i].block || d == &dc->uncached || saved_block(dc, d, pc))
+            continue;
+#ifdef JIT_X86_64
+        if (dc->jit) {
+            jit_translate(cs, pc);
+            continue;
         }
-        //OUT
-        case 0xd3:
-        {
-            st.opbytes = 2;
-            st.opcycles = 10;
-            byte port = opcode[1];
-            state->ports[port] = state->reg[0];
-            state->write_flag = port;
-            break;
+#endif
+        if (dc->threaded) translate_block(cs, pc);
+    }
+    free(ops);
+    return 1;
+}
+
+/*
+    Ahead-of-time translation. recomp8080 turns a ROM image into C: a
+    function, aot_run, that stands in for runCPU, with a labelled run of
+    handler calls for each basic block it finds in the image (with the
+    instruction bytes as constants, so the compiler can optimise across
+    the whole block) that goes straight on to whichever of the blocks
+    known to follow it pc is at. As in runCPU, it works on a local copy
+    of the CPU state. The generated file defines CPU_AOT and includes
+    this one, so it is built in place of cpu.c, and is written with the
+    macros below. Blocks are only run from pages that still map the
+    image read-only; anything else (code in RAM, or reached through a
+    jump the translator couldn't follow) is run one instruction at a
+    time with executeOp.
+*/
+#ifdef CPU_AOT
+#ifdef CPU_CHECKS
+#error "translated code can't stop on the traps a CPU_CHECKS build checks for"
+#endif
+
+//from the generated code: whether memory holds the image it was
+//translated from, and runCPU for it
+static int aot_image_loaded(CPUState *state);
+static NOINLINE int aot_run(CPUState *cs, int cycle_budget);
+
+#define AOT_PROLOGUE \
+    CPUState local = *cs, *state = &local; \
+    MemoryMap *map = state->map; \
+    int cycles = 0; \
+    OpStats st; \
+    byte buf[3]; \
+    state->write_flag = -1; \
+    state->trap = TRAP_NONE; \
+    state->lf = lazyFlags(state->fl); \
+    if (cycle_budget <= 0) goto done; \
+  dispatch:
+
+//run the instruction at pc (when it doesn't start a block that can be
+//run), then look for a block again
+#define AOT_INTERPRET \
+  interpret: \
+    st = executeOp(state, fetch_op(state, buf)); \
+    state->pc += st.opbytes; \
+    cycles += st.opcycles; \
+    if (st.opcycles == 0 || state->halted || state->write_flag >= 0 || \
+        cycles >= cycle_budget) \
+        goto done; \
+    goto dispatch;
+
+//the block at 0xadr, in page page, taking before_last cycles before its
+//last instruction. it is only run if runCPU would stop no earlier than
+//that instruction.
+#define AOT_BLOCK(adr, page, before_last) \
+  aot_##adr: \
+    if (map->write[page] != NULL || map->clean[page] != NULL || \
+        map->read[page] != state->memory + (page) * PAGE_SIZE || \
+        cycles + (before_last) >= cycle_budget) \
+        goto interpret;
+
+#define AOT_OP(handler, b0, b1, b2) handler(state, (byte []) {b0, b1, b2});
+
+#define AOT_LAST(adr, before_last, handler, b0, b1, b2) \
+    state->pc = adr; \
+    st = table_stats(b0, handler(state, (byte []) {b0, b1, b2})); \
+    state->pc += st.opbytes; \
+    cycles += (before_last) + st.opcycles; \
+    if (state->write_flag >= 0 || cycles >= cycle_budget) goto done;
+
+//go on to the block at 0xadr if that's where pc is
+#define AOT_NEXT(adr) if (state->pc == 0x##adr) goto aot_##adr;
+
+#define AOT_DISPATCH goto dispatch;
+
+#define AOT_EPILOGUE \
+  done: \
+    local.fl = flagsView(local.lf); \
+    *cs = local; \
+    return cycles;
+#endif
+
+int enableAOT(CPUState *cs) {
+#ifdef CPU_AOT
+    if (!aot_image_loaded(cs)) return 0;
+    cs->aot = 1;
+    setCPUHooks(cs, cs->hooks);
+    return 1;
+#else
+    (void) cs;
+    return 0;
+#endif
+}
+
+/*
+    Idle loops. Code that waits for an interrupt often spins on a short
+    loop that only reads memory or ports, such as LDA flag; ANA A; JZ
+    back. Interrupts are only taken between runCPU calls, and nothing
+    else writes memory or ports during one, so once such a loop has come
+    back round to where it was with the same registers and flags, it
+    will go round the same way until the run ends. Every
+    IDLE_CHECK_CYCLES, runCPU looks for a loop like that around pc (out
+    of line, so nothing is added to the instructions in between), and
+    if it finds one, it runs one pass of it and counts the rest of the
+    passes that finish within the budget without running them. A run
+    stops where and with what it would have anyway.
+*/
+#define IDLE_CHECK_CYCLES 2048
+#define IDLE_LOOP_MAX 32 //bytes from the start of a loop to its jump
+
+//JMP and Jcc
+#define IS_JUMP(op) ((op) == 0xc3 || ((op) & 0xc7) == 0xc2)
+
+//whether the instruction can be part of an idle loop: it doesn't
+//branch, write memory or stop
+static int only_reads(byte op) {
+    return !ends_block(op) && !leaves_block_early(op) && op != 0x76;
+}
+
+//whether the instruction at adr is IN from a port with a handler
+static int handled_in(CPUState *state, int adr, byte op) {
+    return op == 0xdb && state->map->in[read_byte(state, adr + 1)];
+}
+
+//the cycles taken by passes through the loop around pc, if it is
+//idle: one pass is run, stopping early if it leaves the loop or reaches
+//the budget, and the passes after it are skipped if it comes back with
+//everything as it was. reads through the host's handler could do
+//anything, so loops aren't looked for if there is one, and loops that
+//read a port with a handler aren't idle.
+static NOINLINE int idle_cycles(CPUState *state, int cycles,
+                                int cycle_budget) {
+    int pc = state->pc, adr = pc, start;
+    byte buf[3], op = 0;
+    if (state->map->read_handler) return 0;
+    //the jump closing the loop, and then its start
+    for (; adr - pc <= IDLE_LOOP_MAX; adr += oplen[op]) {
+        op = read_byte(state, adr);
+        if (handled_in(state, adr, op)) return 0;
+        if (!only_reads(op)) break;
+    }
+    if (!IS_JUMP(op) || adr > 0xfffc) return 0;
+    start = read_byte(state, adr + 1) | read_byte(state, adr + 2) << 8;
+    if (start > pc || adr - start > IDLE_LOOP_MAX) return 0;
+    for (int at = start; at < pc; at += oplen[op]) {
+        op = read_byte(state, at);
+        if (!only_reads(op) || handled_in(state, at, op) ||
+            at + oplen[op] > pc)
+            return 0;
+    }
+
+    byte a = state->a, psw = state->fl.psw, int_enable = state->int_enable;
+    uint16_t bc = state->bc, de = state->de, hl = state->hl, sp = state->sp;
+    int taken = 0, stopped;
+    state->lf = lazyFlags(state->fl);
+    do {
+        OpStats st = executeOp(state, fetch_op(state, buf));
+        state->pc += st.opbytes;
+        taken += st.opcycles;
+        stopped = TRAPPED || cycles + taken >= cycle_budget;
+    } while (!stopped && state->pc != pc && state->pc >= start &&
+             state->pc <= adr);
+    state->fl = flagsView(state->lf);
+    if (!stopped && state->pc == pc && state->a == a && state->bc == bc &&
+        state->de == de && state->hl == hl && state->sp == sp &&
+        state->fl.psw == psw && state->int_enable == int_enable) {
+        //runCPU stops after the first instruction that reaches the
+        //budget, so every pass that ends before it would be run
+        cycles += taken;
+        taken += (cycle_budget - 1 - cycles) / taken * taken;
+    }
+    return taken;
+}
+
+//how far runCPU goes before looking for an idle loop again
+static inline int idle_check_at(int cycles, int cycle_budget) {
+    return cycle_budget - cycles > IDLE_CHECK_CYCLES ?
+           cycles + IDLE_CHECK_CYCLES : cycle_budget;
+}
+
+/*
+    Bulk execution. The handlers are inlined into a single loop that
+    works on a local copy of the CPU state, so the compiler can keep the
+    registers, pc and sp out of memory for the whole run, and dispatch
+    jumps straight from the end of one handler to the start of the next
+    through a computed-goto table (a switch is used for compilers without
+    the labels-as-values extension).
+*/
+#if defined(__GNUC__) && !defined(CPU_PORTABLE_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+//runCPU fetches instructions from a window of the address space whose
+//pages follow one another in host memory, so inside it the next
+//instruction is found without going through the map. the window is
+//the run of such pages around pc, less the last two bytes (where an
+//instruction's operands could run out of it); outside it, a new window
+//is found, and instructions that are in none are fetched with fetch_op.
+typedef struct CodeWindow {
+    byte *code; //host memory for the first byte of the window
+    uint16_t start; //address of the first byte
+    uint16_t len; //length in bytes (0 for no window)
+} CodeWindow;
+
+//the run of pages is kept in the map, so later runs in it don't have
+//to look for it again
+static NOINLINE CodeWindow find_window(CPUState *state) {
+    MemoryMap *map = state->map;
+    byte **read = map->read;
+    int first = state->pc >> 8, last = first;
+    if (read[first] == NULL) return (CodeWindow) {NULL, 0, 0};
+    if (first >= map->window_first && first <= map->window_last) {
+        first = map->window_first;
+        last = map->window_last;
+    } else {
+        while (first > 0 && read[first - 1] == read[first] - PAGE_SIZE)
+            first--;
+        while (last < 255 && read[last + 1] == read[last] + PAGE_SIZE)
+            last++;
+        map->window_first = first;
+        map->window_last = last;
+    }
+    return (CodeWindow) {read[first], first * PAGE_SIZE,
+                         (last - first + 1) * PAGE_SIZE - 2};
+}
+
+static ALWAYS_INLINE byte *fetch_windowed(CPUState *state, byte *buf,
+                                          CodeWindow *w) {
+    uint16_t offset = state->pc - w->start;
+    if (LIKELY(offset < w->len)) return w->code + offset;
+    *w = find_window(state);
+    offset = state->pc - w->start;
+    if (offset < w->len) return w->code + offset;
+    return fetch_op(state, buf);
+}
+
+//runCPU does not use the decode cache: the handlers it inlines are
+//already specialised per opcode, so an instruction found in the window
+//needs no further decoding, and looking it up in the cache costs more
+//than fetching it
+#define FETCH() op = fetch_windowed(state, buf, &window)
+
+#ifdef CPU_PROFILE
+//opcode n-gram counts for printProfile. pairs are counted in a table
+//indexed by the two opcodes; there are too many possible triples for
+//that, so they go in a hash table (keyed by the three opcodes, with
+//linear probing), and any that do not fit once it is full are dropped.
+#define PROFILE_SLOTS 0x10000
+typedef struct NgramCount {
+    uint32_t key;
+    uint64_t count;
+} NgramCount;
+static uint64_t profile_pairs[0x10000];
+static NgramCount profile_triples[PROFILE_SLOTS];
+static uint64_t profile_dropped;
+
+//the last three opcodes a run executed, and how many of them there are
+typedef struct OpHistory {
+    uint32_t ops;
+    int n;
+} OpHistory;
+
+static void profile_op(OpHistory *h, byte code) {
+    h->ops = (h->ops << 8 | code) & 0xffffff;
+    if (h->n < 3) h->n++;
+    if (h->n >= 2) profile_pairs[h->ops & 0xffff]++;
+    if (h->n < 3) return;
+    uint32_t slot = (h->ops * 2654435761u) >> 16;
+    for (int i = 0; i < PROFILE_SLOTS; i++, slot = (slot + 1) % PROFILE_SLOTS) {
+        NgramCount *t = &profile_triples[slot];
+        if (t->count == 0) t->key = h->ops;
+        if (t->key == h->ops) {
+            t->count++;
+            return;
         }
-        //HLT
-        case 0x76:
-        {
-            st.opbytes = 0; break;
+    }
+    profile_dropped++;
+}
+#define PROFILE_OP(code) profile_op(&history, code)
+
+static int by_count(const void *a, const void *b) {
+    uint64_t ca = ((const NgramCount *) a)->count;
+    uint64_t cb = ((const NgramCount *) b)->count;
+    return (ca < cb) - (ca > cb);
+}
+
+static void print_ngrams(FILE *f, NgramCount *counts, int len, int n,
+                         int ops) {
+    qsort(counts, len, sizeof(NgramCount), by_count);
+    for (int i = 0; i < n && i < len && counts[i].count; i++) {
+        fprintf(f, "%12llu ", (unsigned long long) counts[i].count);
+        for (int op = ops - 1; op >= 0; op--)
+            fprintf(f, " %02x", counts[i].key >> (8 * op) & 0xff);
+        fprintf(f, "\n");
+    }
+}
+
+void printProfile(FILE *f, int n) {
+    NgramCount *counts = malloc(PROFILE_SLOTS * sizeof(NgramCount));
+    for (int i = 0; i < 0x10000; i++)
+        counts[i] = (NgramCount) {i, profile_pairs[i]};
+    fprintf(f, "opcode pairs:\n");
+    print_ngrams(f, counts, 0x10000, n, 2);
+    memcpy(counts, profile_triples, PROFILE_SLOTS * sizeof(NgramCount));
+    fprintf(f, "opcode triples:\n");
+    print_ngrams(f, counts, PROFILE_SLOTS, n, 3);
+    if (profile_dropped)
+        fprintf(f, "(%llu triples not counted)\n",
+                (unsigned long long) profile_dropped);
+    free(counts);
+}
+#else
+#define PROFILE_OP(code)
+#endif
+
+//superinstructions: opcode pairs that run back to back often enough in
+//real programs (see printProfile) to be worth a dispatch of their own.
+//when runCPU finds the second opcode of a pair right after the first,
+//it runs it from a copy of its handler that follows the first's, with
+//a direct jump in place of the dispatch table (and, for a conditional
+//jump after an arithmetic instruction, a test of the result in place
+//of the condition table). the copy checks the budget like any other
+//handler, so cycle counts, flags and the points a run can stop at
+//(where the machine's interrupts land) are the same as without it.
+//pairs chain, so POP H; POP D; POP B runs as one sequence.
+#define FUSED_TABLE(X, from) \
+    X(from, 0x05, 0xc2, op_jNZ_result) /* DCR B; JNZ */ \
+    X(from, 0x0d, 0xc2, op_jNZ_result) /* DCR C; JNZ */ \
+    X(from, 0x15, 0xc2, op_jNZ_result) /* DCR D; JNZ */ \
+    X(from, 0x1d, 0xc2, op_jNZ_result) /* DCR E; JNZ */ \
+    X(from, 0x0a, 0x03, op_inx_B) /* LDAX B; INX B */ \
+    X(from, 0x1a, 0x13, op_inx_D) /* LDAX D; INX D */ \
+    X(from, 0x12, 0x13, op_inx_D) /* STAX D; INX D */ \
+    X(from, 0x7e, 0x23, op_inx_H) /* MOV A,M; INX H */ \
+    X(from, 0x77, 0x23, op_inx_H) /* MOV M,A; INX H */ \
+    X(from, 0xbe, 0xc2, op_jNZ_result) /* CMP M; JNZ */ \
+    X(from, 0xbe, 0xca, op_jZ_result) /* CMP M; JZ */ \
+    X(from, 0xfe, 0xc2, op_jNZ_result) /* CPI; JNZ */ \
+    X(from, 0xfe, 0xca, op_jZ_result) /* CPI; JZ */ \
+    X(from, 0xfe, 0xd2, op_jNC_result) /* CPI; JNC */ \
+    X(from, 0xfe, 0xda, op_jC_result) /* CPI; JC */ \
+    X(from, 0xe1, 0xd1, op_pop_D) /* POP H; POP D */ \
+    X(from, 0xd1, 0xc1, op_pop_B) /* POP D; POP B */ \
+    X(from, 0xc1, 0xf1, op_pop_psw) /* POP B; POP PSW */ \
+    X(from, 0xc1, 0xc9, op_ret) /* POP B; RET */ \
+    X(from, 0xd1, 0xc9, op_ret) /* POP D; RET */ \
+    X(from, 0xe1, 0xc9, op_ret) /* POP H; RET */ \
+    X(from, 0xfb, 0xc9, op_ret) /* EI; RET */
+
+//runCPU with the handlers inlined
+static NOINLINE int run_inlined(CPUState *cs, int cycle_budget) {
+    CPUState local = *cs;
+    CPUState *state = &local;
+    int cycles = 0;
+    OpStats st;
+    byte buf[3], *op;
+    CodeWindow window = {NULL, 0, 0};
+#ifdef CPU_PROFILE
+    OpHistory history = {0, 0};
+#endif
+    state->write_flag = -1;
+    state->trap = TRAP_NONE;
+    if (cycle_budget <= 0) return 0;
+    state->lf = lazyFlags(state->fl);
+
+#ifdef THREADED_DISPATCH
+#define DISPATCH_ENTRY(code, handler, ...) [code] = &&run_##code,
+    static void *const dispatch[256] = {
+        OPCODE_TABLE(DISPATCH_ENTRY)
+    };
+#define FUSE(from, first, second, handler) \
+    if ((from) == (first) && *op == (second)) goto fused_##first##_##second;
+#define RUN_OP(code, handler, nbytes, ncycles, ntaken, stop, ...) \
+    run_##code: \
+        PROFILE_OP(code); \
+        st = op_stats(handler(state, op), nbytes, ncycles, ntaken); \
+        state->pc += st.opbytes; \
+        cycles += st.opcycles; \
+        if (OUT_STOPS(code, stop) || TRAPPED || cycles >= cycle_budget) \
+            goto done; \
+        FETCH(); \
+    next_##code: __attribute__((unused)); \
+        FUSED_TABLE(FUSE, code) \
+        goto *dispatch[*op];
+#define FUSED_OP(from, first, second, handler) \
+    fused_##first##_##second: \
+        PROFILE_OP(second); \
+        st = table_stats(second, handler(state, op)); \
+        state->pc += st.opbytes; \
+        cycles += st.opcycles; \
+        if (TRAPPED || cycles >= cycle_budget) goto done; \
+        FETCH(); \
+        goto next_##second;
+
+    FETCH();
+    goto *dispatch[*op];
+    OPCODE_TABLE(RUN_OP)
+    FUSED_TABLE(FUSED_OP, 0)
+#else
+#define RUN_OP(code, handler, nbytes, ncycles, ntaken, stop, ...) \
+    case code: \
+        PROFILE_OP(code); \
+        st = op_stats(handler(state, op), nbytes, ncycles, ntaken); \
+        state->pc += st.opbytes; \
+        cycles += st.opcycles; \
+        if (OUT_STOPS(code, stop) || TRAPPED) goto done; \
+        break;
+
+    while (cycles < cycle_budget) {
+        FETCH();
+        switch (*op) {
+            OPCODE_TABLE(RUN_OP)
         }
-        default:
-        {
-            unknownOp(state); break;
+    }
+#endif
+
+done:
+    local.fl = flagsView(local.lf);
+    *cs = local;
+    return cycles;
+}
+
+//runCPU for a CPU that isn't halted
+static int run(CPUState *cs, int cycle_budget) {
+    if (cs->decoded) {
+#ifdef JIT_X86_64
+        if (cs->decoded->jit) return run_jit(cs, cycle_budget);
+#endif
+        if (cs->decoded->threaded) return run_threaded(cs, cycle_budget);
+    }
+    //a run that stops before the end of a stretch stops there, and one
+    //that reaches it would have gone on, so this stops where running
+    //the whole budget in one go would
+    int cycles = 0;
+    for (;;) {
+        int check_at = idle_check_at(cycles, cycle_budget);
+        cycles += run_inlined(cs, check_at - cycles);
+        if (cycles < check_at || cycles >= cycle_budget || cs->halted ||
+            cs->write_flag >= 0 || cs->trap != TRAP_NONE)
+            return cycles;
+        cycles += idle_cycles(cs, cycles, cycle_budget);
+        if (cs->trap != TRAP_NONE || cycles >= cycle_budget) return cycles;
+    }
+}
+
+/*
+    Cores. stepCPU, runCPU and interruptCPU run on whichever core the
+    state points to: the plain one above (or, with enableAOT, the same
+    with runCPU running translated code), or the instrumented one, which
+    runs every instruction from memory (leaving the decode cache, the
+    JIT and code translated ahead of time alone), with the hooked build
+    of its handler, calling the hooks around it. setCPUHooks switches
+    between them by swapping the pointer, so nothing on the plain core
+    checks for hooks.
+*/
+
+//run the instruction at pc on the instrumented core, returning the
+//bytes and cycles it took, and setting *stop if a run has to stop after
+//it (as runCPU's own loop does) or the fetch hook stopped it first
+static OpStats hooked_op(CPUState *state, int *stop) {
+    const CPUHooks *h = state->hooks;
+    byte buf[3], *op = fetch_op(state, buf);
+    //(the instruction could write over itself)
+    byte code = op[0], port = op[1];
+    uint16_t pc = state->pc;
+    OpStats st;
+    state->write_flag = -1;
+    if (h->fetch) {
+        state->fl = flagsView(state->lf);
+        if (h->fetch(h->ctx, state, op)) {
+            *stop = 1;
+            return (OpStats) {0, 0};
         }
     }
+
+#define HOOKED_OP(opc, handler, nbytes, ncycles, ntaken, nstop, ...) \
+    case opc: \
+        st = op_stats(hooked_##handler(state, op), nbytes, ncycles, ntaken); \
+        *stop = OUT_STOPS(opc, nstop) || TRAPPED; \
+        break;
+    switch (code) {
+        OPCODE_TABLE(HOOKED_OP)
+    }
+
+    if (code == 0xdb && h->in) h->in(h->ctx, port, state->a);
+    if (code == 0xd3 && h->out) h->out(h->ctx, port, state->a);
+    //taken branches, less HLT
+    if (st.opbytes == 0 && st.opcycles != 0 && code != 0x76 && h->branch)
+        h->branch(h->ctx, pc, state->pc);
     return st;
 }
+
+//stepCPU on the instrumented core
+static int hooked_step(CPUState *state) {
+    int stop = 0;
+    state->trap = TRAP_NONE;
+    if (state->halted) {
+        state->write_flag = -1;
+        return opcycles[0x00];
+    }
+    state->lf = lazyFlags(state->fl);
+    OpStats st = hooked_op(state, &stop);
+    state->pc += st.opbytes;
+    state->fl = flagsView(state->lf);
+    return st.opcycles;
+}
+
+//runCPU on the instrumented core, for a CPU that isn't halted
+static int hooked_run(CPUState *state, int cycle_budget) {
+    int cycles = 0, stop = 0;
+    state->write_flag = -1;
+    state->trap = TRAP_NONE;
+    state->lf = lazyFlags(state->fl);
+    while (cycles < cycle_budget && !stop) {
+        OpStats st = hooked_op(state, &stop);
+        state->pc += st.opbytes;
+        cycles += st.opcycles;
+    }
+    state->fl = flagsView(state->lf);
+    return cycles;
+}
+
+static int plain_interrupt(CPUState *state, byte opcode) {
+    return interrupt(state, opcode, 0);
+}
+
+static int hooked_interrupt(CPUState *state, byte opcode) {
+    return interrupt(state, opcode, 1);
+}
+
+static const CPUCore plain_core = {step, run, plain_interrupt};
+static const CPUCore hooked_core = {hooked_step, hooked_run,
+                                    hooked_interrupt};
+#ifdef CPU_AOT
+//the plain core, with runCPU running the code translated ahead of time
+static const CPUCore aot_core = {step, aot_run, plain_interrupt};
+#endif
+
+void setCPUHooks(CPUState *cs, const CPUHooks *hooks) {
+    cs->hooks = hooks;
+    cs->core = hooks ? &hooked_core : &plain_core;
+#ifdef CPU_AOT
+    if (!hooks && cs->aot) cs->core = &aot_core;
+#endif
+}
+
+int stepCPU(CPUState *cs) {
+    return cs->core->step(cs);
+}
+
+int runCPU(CPUState *cs, int cycle_budget) {
+    int cycles = 0;
+    if (!cs->halted) cycles = cs->core->run(cs, cycle_budget);
+    else {
+        cs->write_flag = -1;
+        cs->trap = TRAP_NONE;
+    }
+    //only an interrupt, which can't come until this returns, wakes a
+    //halted CPU, so the rest of the budget goes by at once
+    if (cs->halted && cycles < cycle_budget) cycles = cycle_budget;
+    return cycles;
+}
+
+int interruptCPU(CPUState *cs, byte opcode) {
+    return cs->core->interrupt(cs, opcode);
+}
@@ -1,54 +1,334 @@
 #ifndef _CPU_H
 #define _CPU_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef uint8_t byte;
 
 //data structures for storing the state of the 8080 CPU and memory
 
-typedef struct Flags {
-    byte z:1;
-    byte s:1;
-    byte p:1;
-    byte cy:1;
-    byte ac:1;
-    byte pad:3;
+//the flag register, in the bit positions it has in the PSW byte
+//pushed by PUSH PSW (bit 1 always reads as 1, bits 3 and 5 as 0).
+//the bitfield is only meant for reading or poking single flags; psw
+//is the whole register.
+typedef union Flags {
+    byte psw;
+    struct {
+        byte cy:1;
+        byte one:1;
+        byte p:1;
+        byte pad3:1;
+        byte ac:1;
+        byte pad5:1;
+        byte z:1;
+        byte s:1;
+    };
 } Flags;
 
-typedef struct CPUState {
-    //registers (order a, b, c, d, e, h, l)
-    byte reg[7];
+//flags as the core keeps them while it runs: just enough of the last
+//flag-setting instruction to work out each flag if something reads it,
+//packed into one word so it can live in a register.
+//  bits 0-7    the 8-bit result zero, sign and parity come from
+//              (or a PSW byte, when the flags were set directly)
+//  bit 8       carry
+//  bit 9       set when bits 0-7 hold a PSW byte rather than a result
+//              (so bits 0-9 index the flag tables either way)
+//  bits 16-23  operands xor result of the last addition; bit 4 of it
+//              (bit 20 of the word) is aux carry
+typedef uint32_t LazyFlags;
+#define LF_CY 0x100
+#define LF_PSW 0x200
+#define LF_AC 0x100000
+
+//faults the CPU can stop on. these are only detected when the core is
+//built with CPU_CHECKS; without it every 16-bit address is valid and
+//wraps around the 64K address space, as on the real chip.
+typedef enum CPUTrap {
+    TRAP_NONE = 0,
+    TRAP_STACK_OVERFLOW,  //push with the stack pointer below 2
+    TRAP_STACK_UNDERFLOW, //pop from past the end of RAM
+    TRAP_BAD_ADDRESS      //load, store or jump past the end of RAM
+} CPUTrap;
+
+//the address space as the CPU sees it, in 256-byte pages. each page
+//reads from and writes to 256 bytes of host memory, so RAM, ROM and
+//their mirrors cost the same to access. a NULL page sends accesses to
+//the read or write handler instead, for memory-mapped devices; with no
+//handler, reads give 0xff and writes are ignored (which is how ROM is
+//write-protected).
+typedef byte (*MemReadHandler)(void *ctx, uint16_t adr);
+typedef void (*MemWriteHandler)(void *ctx, uint16_t adr, byte val);
+
+//the I/O address space has a handler for IN from and OUT to each port,
+//for devices to work out what they give when they are read and act on
+//what they are sent as the instruction runs. ports without one are
+//latches in the state's ports array, which OUT hands back to the host
+//to service (see write_flag).
+typedef byte (*PortInHandler)(void *ctx, byte port);
+typedef void (*PortOutHandler)(void *ctx, byte port, byte val);
+
+typedef struct MemoryMap {
+    byte *read[256];
+    byte *write[256];
+    MemReadHandler read_handler;
+    MemWriteHandler write_handler;
+    void *ctx; //passed to the handlers (the port handlers too)
+    //port handlers (see mapPort), NULL for none
+    PortInHandler in[256];
+    PortOutHandler out[256];
+    //the first and last pages of the run runCPU last found code in, of
+    //pages that follow one another in host memory (-1 for none). kept
+    //by the core, and cleared when pages are mapped.
+    int window_first, window_last;
+    //dirty page tracking (see trackDirtyPages): whether it is on, which
+    //pages have been written to since the dirty set was cleared, and
+    //the write pointers of those that haven't, which are taken out of
+    //the map until they are
+    int track_dirty;
+    byte dirty[256];
+    byte *clean[256];
+} MemoryMap;
+
+//instructions decoded ahead of time (see enableDecodeCache), and the
+//part of them states can share (see shareDecodeCache)
+typedef struct DecodeCache DecodeCache;
+typedef struct SharedCode SharedCode;
+
+//the code stepCPU, runCPU and interruptCPU run on (see setCPUHooks)
+typedef struct CPUCore CPUCore;
+
+//diagnostic hooks, for the instrumented core to call with ctx (see
+//setCPUHooks). any of them may be NULL.
+typedef struct CPUState CPUState;
+typedef struct CPUHooks {
+    //before each instruction, with its bytes (and fl up to date).
+    //returning nonzero stops stepCPU or runCPU before it runs, leaving
+    //pc on it, as a breakpoint does.
+    int (*fetch)(void *ctx, CPUState *cs, const byte *opcode);
+    //after each byte of memory an instruction reads or writes
+    void (*read)(void *ctx, uint16_t adr, byte val);
+    void (*write)(void *ctx, uint16_t adr, byte val);
+    //after IN and OUT, with the port and the byte that went through it
+    void (*in)(void *ctx, byte port, byte val);
+    void (*out)(void *ctx, byte port, byte val);
+    //when a jump, call, return or RST is taken, or an interrupt is
+    //delivered (from being the address it returns to)
+    void (*branch)(void *ctx, uint16_t from, uint16_t to);
+    void *ctx;
+} CPUHooks;
+
+//a register pair (BC, DE or HL) that can be used as a 16-bit value or
+//as its two 8-bit registers. the high register holds the upper byte of
+//the pair, so which of the two comes first in memory depends on the
+//byte order of the host.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REGISTER_PAIR(hi, lo) union { \
+    uint16_t hi##lo; \
+    struct { byte hi, lo; }; \
+}
+#else
+#define REGISTER_PAIR(hi, lo) union { \
+    uint16_t hi##lo; \
+    struct { byte lo, hi; }; \
+}
+#endif
+
+struct CPUState {
+    //registers: the accumulator a, and the pairs bc, de and hl
+    //(which are also b and c, d and e, h and l)
+    byte a;
+    REGISTER_PAIR(b, c);
+    REGISTER_PAIR(d, e);
+    REGISTER_PAIR(h, l);
 
     uint16_t sp; //stack pointer
     uint16_t pc; //program counter/instruction pointer
-    byte *memory; //RAM
+    //flag register. this is a view of lf, brought up to date when
+    //stepCPU or runCPU returns, and read back when they are called.
     Flags fl;
     byte int_enable;
-    unsigned int mem_size;
+    //set by HLT, which leaves pc on it. the CPU does nothing until
+    //interruptCPU delivers an RST, which returns to the instruction
+    //after the HLT; a host that moves pc on itself clears this.
+    byte halted;
+    LazyFlags lf;
 
     //this will be equal to the port number when the most 
-    //recent executed instruction was OUT
+    //recent executed instruction was OUT to a port without a handler
     //- this is needed to trigger machine hardware
     //that is signalled by the CPU writing to output ports.
     //set to -1 otherwise.
     int write_flag;
+    //the fault the last call to stepCPU or runCPU stopped on. the
+    //faulting instruction is not executed and pc is left on it.
+    CPUTrap trap;
+    //amount of RAM the program is expected to use, which the checks in
+    //a CPU_CHECKS build test addresses against
+    unsigned int mem_size;
+    byte *memory; //RAM (the whole 64K address space)
+    //where each page of the address space really goes. starts out
+    //mapping every page to the same page of memory.
+    MemoryMap *map;
+    //decoded instructions by address, or NULL when they are decoded
+    //every time they run
+    DecodeCache *decoded;
+    //the core stepCPU, runCPU and interruptCPU run on (see setCPUHooks)
+    const CPUCore *core;
+
+    //everything above is used as the CPU runs, and fits in the 64-byte
+    //cache line the state starts on. what follows is only touched by
+    //IN, OUT and the host.
+
     //I/O address space
     byte ports[256];
-} CPUState;
+    //room for the host's own state (see newStateWithHost), or NULL
+    void *host;
+    //the hooks the instrumented core calls (see setCPUHooks), or NULL
+    const CPUHooks *hooks;
+    //whether runCPU runs code translated from the ROM ahead of time
+    //(see enableAOT) while it has no hooks
+    int aot;
+};
 
-//create a new CPU state with mem_size bytes of RAM
+//create a new CPU state with mem_size bytes of RAM. memory always
+//covers the full 64K address space, whatever mem_size is. the state,
+//the memory map and memory are all one allocation.
 CPUState *newState(unsigned int mem_size);
 
+//create a new CPU state as newState does, with host_size bytes of
+//zeroed memory for the host's own state (at host) between the ports
+//and the memory map. it is freed along with the rest.
+CPUState *newStateWithHost(unsigned int mem_size, size_t host_size);
+
 //clean up and free the CPU state
 void destroyState(CPUState *cs);
 
+//map npages pages of the address space, starting at page first, to
+//consecutive 256-byte pages of host memory starting at read (for
+//reads) and write (for writes). either may be NULL to send those
+//accesses to the map's handlers.
+void mapPages(CPUState *cs, int first, int npages, byte *read, byte *write);
+
+//give port in and out handlers (either may be NULL, for a latch in
+//ports as before). OUT to a port with a handler doesn't set write_flag
+//or stop runCPU. the handlers get the map's ctx.
+void mapPort(CPUState *cs, byte port, PortInHandler in, PortOutHandler out);
+
+//keep track of the pages the CPU writes to, starting with none. a
+//page's first write after the dirty set is cleared goes through the
+//map's slow path, which marks it (and any page writing to the same host
+//memory, such as a mirror) dirty and puts its write pointer back, so
+//the pages cost nothing extra from then on, and clean pages nothing
+//at all. writes by the host itself aren't seen, and pages mapped with
+//mapPages while this is on count as dirty.
+void trackDirtyPages(CPUState *cs);
+
+//copy whether each page of the address space is dirty into dirty (256
+//bytes), returning how many are, and mark them all clean again
+int getDirtyPages(CPUState *cs, byte *dirty);
+void clearDirtyPages(CPUState *cs);
+
+//have stepCPU decode each instruction once, the first time it runs,
+//and keep it for next time (runCPU fetches from memory whether or not
+//this is on). guest writes to memory holding a decoded instruction
+//drop it from the cache (the pages they are in are written through
+//the map's slow path to catch them), but the host must call
+//flushDecodeCache after writing to memory itself.
+void enableDecodeCache(CPUState *cs);
+void flushDecodeCache(CPUState *cs);
+
+//decoded instructions and threaded blocks for code in ROM, for any
+//number of CPU states running the same program to share, from any
+//number of threads. newSharedCode makes an empty one, holding a
+//reference to it for the caller; each state given it holds another
+//until it is destroyed, and it is freed when the last is released.
+SharedCode *newSharedCode(void);
+void releaseSharedCode(SharedCode *sc);
+
+//have cs (turning its decode cache on) take the decoded instructions
+//and threaded blocks of each page that no page of its address space
+//writes to from sc, adding them to sc if no other state has yet. code
+//in RAM is decoded by each state for itself, as is JIT code. shared
+//pages are looked up by their bytes, so the rule about host writes
+//is the same as for the decode cache.
+void shareDecodeCache(CPUState *cs, SharedCode *sc);
+
+//have runCPU run code it has been through before as threaded blocks:
+//runs of instructions decoded into lists of handlers to call, with the
+//cycle budget only checked between blocks (turning on the decode
+//cache, which keeps track of them). this needs nothing from the host
+//compiler, and the same rule about host writes applies. it is much
+//quicker than stepCPU, but runCPU's own loop, which inlines every
+//handler, is quicker still.
+void enableThreadedBlocks(CPUState *cs);
+
+//have runCPU translate code it runs often into host code (turning on
+//the decode cache, which keeps track of it). returns 0 if the JIT isn't
+//available: it is only built for x86-64 hosts with CPU_JIT, and not
+//with CPU_CHECKS. translated code sees guest writes the way the decode
+//cache does, so the same rule about host writes applies.
+int enableJIT(CPUState *cs);
+
+//in an emulator built with C translated from its ROM by recomp8080,
+//have runCPU run that (which takes precedence over the JIT and
+//threaded blocks). returns 0 if there isn't any, or memory doesn't
+//hold the ROM image it was translated from, so call it after loading
+//the ROM. the host must not write to the ROM after that.
+int enableAOT(CPUState *cs);
+
+//save what the decode cache has found out about the program that is
+//running (which instructions it has decoded, how often each has run,
+//and which blocks threaded blocks or the JIT have translated) to a
+//file at path, returning 0 if it couldn't be written.
+int saveDecodeCache(CPUState *cs, const char *path);
+
+//start the decode cache off (turning it on) with what saveDecodeCache
+//saved to path, translating the same blocks again with whichever of
+//threaded blocks and the JIT is on, so that the program doesn't have to
+//warm up again. turn those on first, and call this after loading the
+//program: the file is only used if the instructions it lists are still
+//in memory, checked against a hash of their bytes. returns 0 if it
+//wasn't used (leaving the decode cache as it was). guest writes drop
+//what was loaded as they would anything else the decode cache holds.
+int loadDecodeCache(CPUState *cs, const char *path);
+
 //fetch and execute one instruction, return the number of cycles
-//it took
+//it took (0 if it trapped). a halted CPU idles for as long as a NOP
+//takes instead.
 int stepCPU(CPUState *cs);
 
-//execute one instruction from an interrupt, return the number of
-//cycles it took
+//fetch and execute instructions until at least cycle_budget cycles
+//have been used, return the number of cycles taken. stops early
+//(leaving pc on the instruction) at a trap, and after an OUT to a port
+//without a handler so the host can service write_flag before the next
+//instruction. once the CPU halts (or if it already has), the rest of
+//the budget is used up at once, idling until the host delivers an
+//interrupt.
+int runCPU(CPUState *cs, int cycle_budget);
+
+//run stepCPU, runCPU and interruptCPU on the instrumented core, which
+//calls hooks as it goes, or (with NULL) on the plain one again. the
+//two are built from the same handlers, and this swaps the pointer the
+//state runs them through, so the plain core pays nothing for hooks and
+//a running program can have them attached and taken off between calls.
+//the instrumented core runs every instruction from memory, one at a
+//time, whatever else is turned on (which carries on where it left off
+//when the hooks are taken off). hooks must stay valid until then.
+void setCPUHooks(CPUState *cs, const CPUHooks *hooks);
+
+#ifdef CPU_PROFILE
+#include <stdio.h>
+
+//in a CPU_PROFILE build, runCPU's own loop counts how often each pair
+//and triple of opcodes runs back to back (threaded blocks and the JIT
+//aren't counted). printProfile writes the n most common of each to f,
+//the numbers runCPU's superinstructions are chosen from.
+void printProfile(FILE *f, int n);
+#endif
+
+//execute one instruction from an interrupt (waking the CPU if it is
+//halted), return the number of cycles it took
 int interruptCPU(CPUState *cs, byte opcode);
 
 #endif //_CPU_H
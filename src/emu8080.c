@@ -1,5 +1,6 @@
 #include <SDL.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "machine.h"
 
@@ -17,8 +18,10 @@ const int sinv_width = 224;
 const int window_height = 3 * sinv_height;
 const int window_width = 3 * sinv_width;
 
-//write a 1bpp framebuffer to the screen
-static void showBuffer(const byte *buffer, SDL_Surface *surf);
+//write a 1bpp framebuffer to the screen, skipping the 256-byte pages
+//of it that dirty says haven't changed
+static void showBuffer(const byte *buffer, const byte *dirty,
+                       SDL_Surface *surf);
 static void setPixel(SDL_Surface *surf, int x, int y, int val);
 
 //handle keyboard input
@@ -26,8 +29,19 @@ static void handleKB(SDL_Keycode k, Machine *m, int press);
 
 int main(int argc, char **argv) {
 
+    //with -c, the decode cache is started off from the file given (if
+    //it was saved from the same ROM), and saved back to it on quitting,
+    //so the JIT doesn't have to warm up again each time
+    const char *cache_file = NULL;
+    if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+        cache_file = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <space invaders ROM files>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-c <decode cache file>] "
+                "<space invaders ROM files>\n", argv[0]);
         return 1;
     }
 
@@ -74,17 +88,34 @@ int main(int argc, char **argv) {
         fprintf(stderr, "File ends at 0x%04x\n",
             memctr - 1);
     }
+#ifndef CPU_PROFILE
+    //after loading, since host writes aren't seen by translated code
+    //(and not when profiling, as only runCPU's own loop is counted).
+    //emu8080_aot runs the ROM translated ahead of time instead
+    if (!enableAOT(m->cs)) {
+        enableJIT(m->cs);
+        if (cache_file) loadDecodeCache(m->cs, cache_file);
+    }
+#endif
 
     int quit = 0;
     SDL_Event e;
 
     unsigned int frames = 0;
+    //the screen is drawn whole the first time, then only where the CPU
+    //has written to video RAM (which starts on a page of the CPU's
+    //memory, and so of its address space)
+    byte dirty[256];
+    const byte *vram_dirty = dirty + (m->framebuffer - m->cs->memory) / 256;
+    trackDirtyPages(m->cs);
 
     uint32_t loop_start = SDL_GetTicks();
 
     while (!quit) {
         stepFrame(m);
-        showBuffer(m->framebuffer, screenSurface);
+        getDirtyPages(m->cs, dirty);
+        if (frames == 0) memset(dirty, 1, sizeof(dirty));
+        showBuffer(m->framebuffer, vram_dirty, screenSurface);
         SDL_UpdateWindowSurface(window);
 
         frames++;
@@ -96,6 +127,9 @@ int main(int argc, char **argv) {
                 double fps = 1000 * (double) frames / (double) time;
                 time /= 1000;
                 printf("Rendered %d frames in %d seconds = %.2f fps\n", frames, time, fps);
+#ifdef CPU_PROFILE
+                printProfile(stdout, 20);
+#endif
             } else if (e.type == SDL_KEYDOWN) {
                 handleKB(e.key.keysym.sym, m, PRESS);
             } else if (e.type == SDL_KEYUP) {
@@ -113,6 +147,9 @@ int main(int argc, char **argv) {
 
     }
 
+    if (cache_file && m->cs->decoded &&
+        !saveDecodeCache(m->cs, cache_file))
+        fprintf(stderr, "Failed to save decode cache to %s\n", cache_file);
     destroyMachine(m);
     
     SDL_DestroyWindow(window);
@@ -121,12 +158,14 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-static void showBuffer(const uint8_t *buffer, SDL_Surface *surf) {
+static void showBuffer(const uint8_t *buffer, const byte *dirty,
+                       SDL_Surface *surf) {
     //write each pixel as a 3*3 block on the surface
     for (int sinv_px_ind = 0;
        sinv_px_ind < sinv_height * sinv_width;
        sinv_px_ind++) {
         int px_byte = sinv_px_ind / 8;
+        if (!dirty[px_byte / 256]) continue;
         int px_bit = sinv_px_ind % 8;
         int px = (buffer[px_byte] >> (px_bit)) & 0x01;
         //x, y measured from top left
@@ -1,17 +1,43 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "machine.h"
+#include "board.h"
 #include "cpu.h"
 
 //timing ratio constant
 //60 Hz screen refresh, 2 MHz CPU
 const int cycles_per_frame = 33333;
 
+static void midScreen(void *ctx, uint64_t when);
+static void vblank(void *ctx, uint64_t when);
+
+//the port handlers, from the board's description of its ports
+#define IN_HANDLER(port, expr) \
+    static byte in##port(void *ctx, byte p) { \
+        Machine *m = ctx; \
+        return (expr); \
+    }
+#define OUT_HANDLER(port, action) \
+    static void out##port(void *ctx, byte p, byte val) { \
+        Machine *m = ctx; \
+        (void) m; \
+        action; \
+    }
+BOARD_IN_PORTS(IN_HANDLER)
+BOARD_OUT_PORTS(OUT_HANDLER)
+
 Machine *newMachine() {
-    Machine *m = malloc(sizeof(Machine));
-    //machine has an 8080 CPU with 16K of memory total
-    //(8K is ROM but let's just have it all as RAM)
-    CPUState *cs = newState(0x4000);
+    //machine has an 8080 CPU with the board's memory (see board.h).
+    //writes to ROM are ignored. the rest of the machine is kept with
+    //the CPU.
+    CPUState *cs = newStateWithHost(BOARD_MEMORY, sizeof(Machine));
+    Machine *m = cs->host;
+    for (int page = 0; page < 0x100; page += BOARD_MEMORY / 0x100) {
+        mapPages(cs, page, BOARD_ROM / 0x100, cs->memory, NULL);
+        mapPages(cs, page + BOARD_ROM / 0x100,
+                 (BOARD_MEMORY - BOARD_ROM) / 0x100, &cs->memory[BOARD_ROM],
+                 &cs->memory[BOARD_ROM]);
+    }
     //Video RAM starts at 9K
     uint8_t *framebuffer = (uint8_t *) &cs->memory[0x2400];
     //coin slot is port 1, bit 0.
@@ -29,47 +55,64 @@ Machine *newMachine() {
     m->button_inputs[1] = 0x08;
     m->button_inputs[2] = 0x00;
 
+    //the buttons and the shift register are read and written as the
+    //program runs them, so IN and OUT don't stop runCPU
+    cs->map->ctx = m;
+#define MAP_IN(port, expr) mapPort(cs, port, in##port, NULL);
+#define MAP_OUT(port, action) mapPort(cs, port, cs->map->in[port], out##port);
+    BOARD_IN_PORTS(MAP_IN)
+    BOARD_OUT_PORTS(MAP_OUT)
+
+    //the two interrupts of each frame, at the middle and end of it
+    initScheduler(&m->events);
+    scheduleEvent(&m->events, cycles_per_frame / 2, midScreen, m);
+    scheduleEvent(&m->events, cycles_per_frame, vblank, m);
+
     return m;
 }
 
 void destroyMachine(Machine *m) {
+    //(which frees m with it)
     destroyState(m->cs);
-    m->framebuffer = NULL;
-    free(m);
 }
 
-static void handleOutput(byte port, Machine *m) {
-    if (port == 2) m->shift_amt = m->cs->ports[2];
-    else if (port == 4) {
-        m->shift_reg >>= 8;
-        m->shift_reg |= m->cs->ports[4] << 8;
+//run the CPU up to the next event. every port the program uses has a
+//handler, so runCPU only stops early on a fault.
+static void runToEvent(Machine *m) {
+    uint64_t deadline = nextEventTime(&m->events);
+    while (m->events.now < deadline) {
+        m->events.now += runCPU(m->cs, deadline - m->events.now);
+        if (m->cs->trap != TRAP_NONE) {
+            fprintf(stderr, "CPU fault %d at %04x\n", m->cs->trap, m->cs->pc);
+            exit(1);
+        }
     }
-    //clear output port
-    m->cs->ports[port] = 0;
+}
 
-    //ignore other outputs for now
-    //(will need to deal with sound eventually)
+//half screen (RST 1 from computer archaeology space invaders article).
+//each interrupt is due a frame after the last was, however late that
+//one was delivered, so they keep time however long the machine runs.
+//the cycles the CPU takes to take an interrupt go on the clock too.
+static void midScreen(void *ctx, uint64_t when) {
+    Machine *m = ctx;
+    m->events.now += interruptCPU(m->cs, 0xcf);
+    scheduleEvent(&m->events, when + cycles_per_frame, midScreen, m);
+}
+
+//vblank (RST 2), which ends the frame
+static void vblank(void *ctx, uint64_t when) {
+    Machine *m = ctx;
+    m->events.now += interruptCPU(m->cs, 0xd7);
+    scheduleEvent(&m->events, when + cycles_per_frame, vblank, m);
+    m->frame_done = 1;
 }
 
 void stepFrame(Machine *m) {
-    int ncycles = 0;
-    while (ncycles < cycles_per_frame / 2) {
-        // fire input ports according to button and shift reg state
-        for (int inport = 0; inport < 3; inport++)
-            m->cs->ports[inport] = m->button_inputs[inport];
-        m->cs->ports[3] = (m->shift_reg >> (8 - m->shift_amt)) & 0xff;
-        ncycles += stepCPU(m->cs);
-        if (m->cs->write_flag >= 0) handleOutput(m->cs->write_flag, m);
-    }
-    //half screen (RST 1 from computer archaeology space invaders article)
-    interruptCPU(m->cs, 0xcf);
-    while (ncycles < cycles_per_frame) {
-        m->cs->ports[3] = (m->shift_reg << m->shift_amt) >> 8;
-        ncycles += stepCPU(m->cs);
-        if (m->cs->write_flag >= 0) handleOutput(m->cs->write_flag, m);
+    m->frame_done = 0;
+    while (!m->frame_done) {
+        runToEvent(m);
+        runEvents(&m->events);
     }
-    //vblank (RST 2)
-    interruptCPU(m->cs, 0xd7);
 }
 
 void keyPressRelease(button b, Machine *m, int press) {
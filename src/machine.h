@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "cpu.h"
+#include "scheduler.h"
 
 /*
     Header that defines the interface for the Space Invaders arcade machine
@@ -16,6 +17,10 @@ typedef struct Machine {
     int shift_amt;
     uint8_t *framebuffer;
     uint8_t button_inputs[3];
+    //the CPU's cycle clock, with the interrupts due on it
+    Scheduler events;
+    //set when stepFrame's frame is over
+    int frame_done;
 } Machine;
 
 //make a new machine struct and destroy an existing one
@@ -0,0 +1,295 @@
+#ifndef _OPCODES_H
+#define _OPCODES_H
+
+/*
+    The 8080 opcode map, as an X macro with everything known about each
+    opcode ahead of time:
+        X(opcode, handler, length in bytes, cycles taken, cycles taken
+          when it branches, whether it hands control back to the host
+          when run from runCPU (for OUT, only to a port without a
+          handler), mnemonic, register operands, immediate
+          operand format, flags read, flags written)
+    The core, the disassembler and the tools and tests take lengths,
+    cycle counts and flag usage from here rather than keeping their own.
+    Instructions that can't branch take the same number of cycles either
+    way; HLT counts as a branch that leaves pc where it is. The handlers
+    are the ones in cpu.c, and tools that generate code for the core
+    (see recomp8080.c) use their names. Macros that only need the first
+    few columns can take the rest as "...".
+*/
+
+//flags by their bits in the PSW byte: Z, S, P, CY and AC
+#define FLAG_CY 0x01
+#define FLAG_P 0x04
+#define FLAG_AC 0x10
+#define FLAG_Z 0x40
+#define FLAG_S 0x80
+#define FLAGS_ALL (FLAG_CY | FLAG_P | FLAG_AC | FLAG_Z | FLAG_S)
+#define FLAGS_ZSPA (FLAGS_ALL & ~FLAG_CY) //all but carry, as INR and DCR set
+
+//the immediate operand that follows the opcode byte: none, a byte (or
+//port number), a 16-bit value, or a 16-bit address
+#define OPERAND_NONE 0
+#define OPERAND_D8 1
+#define OPERAND_D16 2
+#define OPERAND_ADR 3
+
+#define OPCODE_TABLE(X) \
+    X(0x00, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x01, op_lxi_B,    3, 10, 10, 0, "LXI",  "B",   OPERAND_D16,  0,                 0) \
+    X(0x02, op_stax_B,   1, 7,  7,  0, "STAX", "B",   OPERAND_NONE, 0,                 0) \
+    X(0x03, op_inx_B,    1, 5,  5,  0, "INX",  "B",   OPERAND_NONE, 0,                 0) \
+    X(0x04, op_inr_B,    1, 5,  5,  0, "INR",  "B",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x05, op_dcr_B,    1, 5,  5,  0, "DCR",  "B",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x06, op_mvi_B,    2, 7,  7,  0, "MVI",  "B",   OPERAND_D8,   0,                 0) \
+    X(0x07, op_rlc,      1, 4,  4,  0, "RLC",  "",    OPERAND_NONE, 0,                 FLAG_CY) \
+    X(0x08, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x09, op_dad_B,    1, 10, 10, 0, "DAD",  "B",   OPERAND_NONE, 0,                 FLAG_CY) \
+    X(0x0a, op_ldax_B,   1, 7,  7,  0, "LDAX", "B",   OPERAND_NONE, 0,                 0) \
+    X(0x0b, op_dcx_B,    1, 5,  5,  0, "DCX",  "B",   OPERAND_NONE, 0,                 0) \
+    X(0x0c, op_inr_C,    1, 5,  5,  0, "INR",  "C",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x0d, op_dcr_C,    1, 5,  5,  0, "DCR",  "C",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x0e, op_mvi_C,    2, 7,  7,  0, "MVI",  "C",   OPERAND_D8,   0,                 0) \
+    X(0x0f, op_rrc,      1, 4,  4,  0, "RRC",  "",    OPERAND_NONE, 0,                 FLAG_CY) \
+    X(0x10, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x11, op_lxi_D,    3, 10, 10, 0, "LXI",  "D",   OPERAND_D16,  0,                 0) \
+    X(0x12, op_stax_D,   1, 7,  7,  0, "STAX", "D",   OPERAND_NONE, 0,                 0) \
+    X(0x13, op_inx_D,    1, 5,  5,  0, "INX",  "D",   OPERAND_NONE, 0,                 0) \
+    X(0x14, op_inr_D,    1, 5,  5,  0, "INR",  "D",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x15, op_dcr_D,    1, 5,  5,  0, "DCR",  "D",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x16, op_mvi_D,    2, 7,  7,  0, "MVI",  "D",   OPERAND_D8,   0,                 0) \
+    X(0x17, op_ral,      1, 4,  4,  0, "RAL",  "",    OPERAND_NONE, FLAG_CY,           FLAG_CY) \
+    X(0x18, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x19, op_dad_D,    1, 10, 10, 0, "DAD",  "D",   OPERAND_NONE, 0,                 FLAG_CY) \
+    X(0x1a, op_ldax_D,   1, 7,  7,  0, "LDAX", "D",   OPERAND_NONE, 0,                 0) \
+    X(0x1b, op_dcx_D,    1, 5,  5,  0, "DCX",  "D",   OPERAND_NONE, 0,                 0) \
+    X(0x1c, op_inr_E,    1, 5,  5,  0, "INR",  "E",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x1d, op_dcr_E,    1, 5,  5,  0, "DCR",  "E",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x1e, op_mvi_E,    2, 7,  7,  0, "MVI",  "E",   OPERAND_D8,   0,                 0) \
+    X(0x1f, op_rar,      1, 4,  4,  0, "RAR",  "",    OPERAND_NONE, FLAG_CY,           FLAG_CY) \
+    X(0x20, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x21, op_lxi_H,    3, 10, 10, 0, "LXI",  "H",   OPERAND_D16,  0,                 0) \
+    X(0x22, op_shld,     3, 16, 16, 0, "SHLD", "",    OPERAND_ADR,  0,                 0) \
+    X(0x23, op_inx_H,    1, 5,  5,  0, "INX",  "H",   OPERAND_NONE, 0,                 0) \
+    X(0x24, op_inr_H,    1, 5,  5,  0, "INR",  "H",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x25, op_dcr_H,    1, 5,  5,  0, "DCR",  "H",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x26, op_mvi_H,    2, 7,  7,  0, "MVI",  "H",   OPERAND_D8,   0,                 0) \
+    X(0x27, op_daa,      1, 4,  4,  0, "DAA",  "",    OPERAND_NONE, FLAG_CY | FLAG_AC, FLAGS_ALL) \
+    X(0x28, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x29, op_dad_H,    1, 10, 10, 0, "DAD",  "H",   OPERAND_NONE, 0,                 FLAG_CY) \
+    X(0x2a, op_lhld,     3, 16, 16, 0, "LHLD", "",    OPERAND_ADR,  0,                 0) \
+    X(0x2b, op_dcx_H,    1, 5,  5,  0, "DCX",  "H",   OPERAND_NONE, 0,                 0) \
+    X(0x2c, op_inr_L,    1, 5,  5,  0, "INR",  "L",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x2d, op_dcr_L,    1, 5,  5,  0, "DCR",  "L",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x2e, op_mvi_L,    2, 7,  7,  0, "MVI",  "L",   OPERAND_D8,   0,                 0) \
+    X(0x2f, op_cma,      1, 4,  4,  0, "CMA",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x30, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x31, op_lxi_SP,   3, 10, 10, 0, "LXI",  "SP",  OPERAND_D16,  0,                 0) \
+    X(0x32, op_sta,      3, 13, 13, 0, "STA",  "",    OPERAND_ADR,  0,                 0) \
+    X(0x33, op_inx_SP,   1, 5,  5,  0, "INX",  "SP",  OPERAND_NONE, 0,                 0) \
+    X(0x34, op_inr_M,    1, 10, 10, 0, "INR",  "M",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x35, op_dcr_M,    1, 10, 10, 0, "DCR",  "M",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x36, op_mvi_M,    2, 10, 10, 0, "MVI",  "M",   OPERAND_D8,   0,                 0) \
+    X(0x37, op_stc,      1, 4,  4,  0, "STC",  "",    OPERAND_NONE, 0,                 FLAG_CY) \
+    X(0x38, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x39, op_dad_SP,   1, 10, 10, 0, "DAD",  "SP",  OPERAND_NONE, 0,                 FLAG_CY) \
+    X(0x3a, op_lda,      3, 13, 13, 0, "LDA",  "",    OPERAND_ADR,  0,                 0) \
+    X(0x3b, op_dcx_SP,   1, 5,  5,  0, "DCX",  "SP",  OPERAND_NONE, 0,                 0) \
+    X(0x3c, op_inr_A,    1, 5,  5,  0, "INR",  "A",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x3d, op_dcr_A,    1, 5,  5,  0, "DCR",  "A",   OPERAND_NONE, 0,                 FLAGS_ZSPA) \
+    X(0x3e, op_mvi_A,    2, 7,  7,  0, "MVI",  "A",   OPERAND_D8,   0,                 0) \
+    X(0x3f, op_cmc,      1, 4,  4,  0, "CMC",  "",    OPERAND_NONE, FLAG_CY,           FLAG_CY) \
+    X(0x40, op_mov_B_B,  1, 5,  5,  0, "MOV",  "B,B", OPERAND_NONE, 0,                 0) \
+    X(0x41, op_mov_B_C,  1, 5,  5,  0, "MOV",  "B,C", OPERAND_NONE, 0,                 0) \
+    X(0x42, op_mov_B_D,  1, 5,  5,  0, "MOV",  "B,D", OPERAND_NONE, 0,                 0) \
+    X(0x43, op_mov_B_E,  1, 5,  5,  0, "MOV",  "B,E", OPERAND_NONE, 0,                 0) \
+    X(0x44, op_mov_B_H,  1, 5,  5,  0, "MOV",  "B,H", OPERAND_NONE, 0,                 0) \
+    X(0x45, op_mov_B_L,  1, 5,  5,  0, "MOV",  "B,L", OPERAND_NONE, 0,                 0) \
+    X(0x46, op_mov_B_M,  1, 7,  7,  0, "MOV",  "B,M", OPERAND_NONE, 0,                 0) \
+    X(0x47, op_mov_B_A,  1, 5,  5,  0, "MOV",  "B,A", OPERAND_NONE, 0,                 0) \
+    X(0x48, op_mov_C_B,  1, 5,  5,  0, "MOV",  "C,B", OPERAND_NONE, 0,                 0) \
+    X(0x49, op_mov_C_C,  1, 5,  5,  0, "MOV",  "C,C", OPERAND_NONE, 0,                 0) \
+    X(0x4a, op_mov_C_D,  1, 5,  5,  0, "MOV",  "C,D", OPERAND_NONE, 0,                 0) \
+    X(0x4b, op_mov_C_E,  1, 5,  5,  0, "MOV",  "C,E", OPERAND_NONE, 0,                 0) \
+    X(0x4c, op_mov_C_H,  1, 5,  5,  0, "MOV",  "C,H", OPERAND_NONE, 0,                 0) \
+    X(0x4d, op_mov_C_L,  1, 5,  5,  0, "MOV",  "C,L", OPERAND_NONE, 0,                 0) \
+    X(0x4e, op_mov_C_M,  1, 7,  7,  0, "MOV",  "C,M", OPERAND_NONE, 0,                 0) \
+    X(0x4f, op_mov_C_A,  1, 5,  5,  0, "MOV",  "C,A", OPERAND_NONE, 0,                 0) \
+    X(0x50, op_mov_D_B,  1, 5,  5,  0, "MOV",  "D,B", OPERAND_NONE, 0,                 0) \
+    X(0x51, op_mov_D_C,  1, 5,  5,  0, "MOV",  "D,C", OPERAND_NONE, 0,                 0) \
+    X(0x52, op_mov_D_D,  1, 5,  5,  0, "MOV",  "D,D", OPERAND_NONE, 0,                 0) \
+    X(0x53, op_mov_D_E,  1, 5,  5,  0, "MOV",  "D,E", OPERAND_NONE, 0,                 0) \
+    X(0x54, op_mov_D_H,  1, 5,  5,  0, "MOV",  "D,H", OPERAND_NONE, 0,                 0) \
+    X(0x55, op_mov_D_L,  1, 5,  5,  0, "MOV",  "D,L", OPERAND_NONE, 0,                 0) \
+    X(0x56, op_mov_D_M,  1, 7,  7,  0, "MOV",  "D,M", OPERAND_NONE, 0,                 0) \
+    X(0x57, op_mov_D_A,  1, 5,  5,  0, "MOV",  "D,A", OPERAND_NONE, 0,                 0) \
+    X(0x58, op_mov_E_B,  1, 5,  5,  0, "MOV",  "E,B", OPERAND_NONE, 0,                 0) \
+    X(0x59, op_mov_E_C,  1, 5,  5,  0, "MOV",  "E,C", OPERAND_NONE, 0,                 0) \
+    X(0x5a, op_mov_E_D,  1, 5,  5,  0, "MOV",  "E,D", OPERAND_NONE, 0,                 0) \
+    X(0x5b, op_mov_E_E,  1, 5,  5,  0, "MOV",  "E,E", OPERAND_NONE, 0,                 0) \
+    X(0x5c, op_mov_E_H,  1, 5,  5,  0, "MOV",  "E,H", OPERAND_NONE, 0,                 0) \
+    X(0x5d, op_mov_E_L,  1, 5,  5,  0, "MOV",  "E,L", OPERAND_NONE, 0,                 0) \
+    X(0x5e, op_mov_E_M,  1, 7,  7,  0, "MOV",  "E,M", OPERAND_NONE, 0,                 0) \
+    X(0x5f, op_mov_E_A,  1, 5,  5,  0, "MOV",  "E,A", OPERAND_NONE, 0,                 0) \
+    X(0x60, op_mov_H_B,  1, 5,  5,  0, "MOV",  "H,B", OPERAND_NONE, 0,                 0) \
+    X(0x61, op_mov_H_C,  1, 5,  5,  0, "MOV",  "H,C", OPERAND_NONE, 0,                 0) \
+    X(0x62, op_mov_H_D,  1, 5,  5,  0, "MOV",  "H,D", OPERAND_NONE, 0,                 0) \
+    X(0x63, op_mov_H_E,  1, 5,  5,  0, "MOV",  "H,E", OPERAND_NONE, 0,                 0) \
+    X(0x64, op_mov_H_H,  1, 5,  5,  0, "MOV",  "H,H", OPERAND_NONE, 0,                 0) \
+    X(0x65, op_mov_H_L,  1, 5,  5,  0, "MOV",  "H,L", OPERAND_NONE, 0,                 0) \
+    X(0x66, op_mov_H_M,  1, 7,  7,  0, "MOV",  "H,M", OPERAND_NONE, 0,                 0) \
+    X(0x67, op_mov_H_A,  1, 5,  5,  0, "MOV",  "H,A", OPERAND_NONE, 0,                 0) \
+    X(0x68, op_mov_L_B,  1, 5,  5,  0, "MOV",  "L,B", OPERAND_NONE, 0,                 0) \
+    X(0x69, op_mov_L_C,  1, 5,  5,  0, "MOV",  "L,C", OPERAND_NONE, 0,                 0) \
+    X(0x6a, op_mov_L_D,  1, 5,  5,  0, "MOV",  "L,D", OPERAND_NONE, 0,                 0) \
+    X(0x6b, op_mov_L_E,  1, 5,  5,  0, "MOV",  "L,E", OPERAND_NONE, 0,                 0) \
+    X(0x6c, op_mov_L_H,  1, 5,  5,  0, "MOV",  "L,H", OPERAND_NONE, 0,                 0) \
+    X(0x6d, op_mov_L_L,  1, 5,  5,  0, "MOV",  "L,L", OPERAND_NONE, 0,                 0) \
+    X(0x6e, op_mov_L_M,  1, 7,  7,  0, "MOV",  "L,M", OPERAND_NONE, 0,                 0) \
+    X(0x6f, op_mov_L_A,  1, 5,  5,  0, "MOV",  "L,A", OPERAND_NONE, 0,                 0) \
+    X(0x70, op_mov_M_B,  1, 7,  7,  0, "MOV",  "M,B", OPERAND_NONE, 0,                 0) \
+    X(0x71, op_mov_M_C,  1, 7,  7,  0, "MOV",  "M,C", OPERAND_NONE, 0,                 0) \
+    X(0x72, op_mov_M_D,  1, 7,  7,  0, "MOV",  "M,D", OPERAND_NONE, 0,                 0) \
+    X(0x73, op_mov_M_E,  1, 7,  7,  0, "MOV",  "M,E", OPERAND_NONE, 0,                 0) \
+    X(0x74, op_mov_M_H,  1, 7,  7,  0, "MOV",  "M,H", OPERAND_NONE, 0,                 0) \
+    X(0x75, op_mov_M_L,  1, 7,  7,  0, "MOV",  "M,L", OPERAND_NONE, 0,                 0) \
+    X(0x76, op_hlt,      1, 7,  7,  1, "HLT",  "",    OPERAND_NONE, 0,                 0) \
+    X(0x77, op_mov_M_A,  1, 7,  7,  0, "MOV",  "M,A", OPERAND_NONE, 0,                 0) \
+    X(0x78, op_mov_A_B,  1, 5,  5,  0, "MOV",  "A,B", OPERAND_NONE, 0,                 0) \
+    X(0x79, op_mov_A_C,  1, 5,  5,  0, "MOV",  "A,C", OPERAND_NONE, 0,                 0) \
+    X(0x7a, op_mov_A_D,  1, 5,  5,  0, "MOV",  "A,D", OPERAND_NONE, 0,                 0) \
+    X(0x7b, op_mov_A_E,  1, 5,  5,  0, "MOV",  "A,E", OPERAND_NONE, 0,                 0) \
+    X(0x7c, op_mov_A_H,  1, 5,  5,  0, "MOV",  "A,H", OPERAND_NONE, 0,                 0) \
+    X(0x7d, op_mov_A_L,  1, 5,  5,  0, "MOV",  "A,L", OPERAND_NONE, 0,                 0) \
+    X(0x7e, op_mov_A_M,  1, 7,  7,  0, "MOV",  "A,M", OPERAND_NONE, 0,                 0) \
+    X(0x7f, op_mov_A_A,  1, 5,  5,  0, "MOV",  "A,A", OPERAND_NONE, 0,                 0) \
+    X(0x80, op_add_B,    1, 4,  4,  0, "ADD",  "B",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x81, op_add_C,    1, 4,  4,  0, "ADD",  "C",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x82, op_add_D,    1, 4,  4,  0, "ADD",  "D",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x83, op_add_E,    1, 4,  4,  0, "ADD",  "E",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x84, op_add_H,    1, 4,  4,  0, "ADD",  "H",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x85, op_add_L,    1, 4,  4,  0, "ADD",  "L",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x86, op_add_M,    1, 7,  7,  0, "ADD",  "M",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x87, op_add_A,    1, 4,  4,  0, "ADD",  "A",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x88, op_adc_B,    1, 4,  4,  0, "ADC",  "B",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x89, op_adc_C,    1, 4,  4,  0, "ADC",  "C",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x8a, op_adc_D,    1, 4,  4,  0, "ADC",  "D",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x8b, op_adc_E,    1, 4,  4,  0, "ADC",  "E",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x8c, op_adc_H,    1, 4,  4,  0, "ADC",  "H",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x8d, op_adc_L,    1, 4,  4,  0, "ADC",  "L",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x8e, op_adc_M,    1, 7,  7,  0, "ADC",  "M",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x8f, op_adc_A,    1, 4,  4,  0, "ADC",  "A",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x90, op_sub_B,    1, 4,  4,  0, "SUB",  "B",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x91, op_sub_C,    1, 4,  4,  0, "SUB",  "C",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x92, op_sub_D,    1, 4,  4,  0, "SUB",  "D",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x93, op_sub_E,    1, 4,  4,  0, "SUB",  "E",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x94, op_sub_H,    1, 4,  4,  0, "SUB",  "H",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x95, op_sub_L,    1, 4,  4,  0, "SUB",  "L",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x96, op_sub_M,    1, 7,  7,  0, "SUB",  "M",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x97, op_sub_A,    1, 4,  4,  0, "SUB",  "A",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0x98, op_sbb_B,    1, 4,  4,  0, "SBB",  "B",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x99, op_sbb_C,    1, 4,  4,  0, "SBB",  "C",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x9a, op_sbb_D,    1, 4,  4,  0, "SBB",  "D",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x9b, op_sbb_E,    1, 4,  4,  0, "SBB",  "E",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x9c, op_sbb_H,    1, 4,  4,  0, "SBB",  "H",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x9d, op_sbb_L,    1, 4,  4,  0, "SBB",  "L",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x9e, op_sbb_M,    1, 7,  7,  0, "SBB",  "M",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0x9f, op_sbb_A,    1, 4,  4,  0, "SBB",  "A",   OPERAND_NONE, FLAG_CY,           FLAGS_ALL) \
+    X(0xa0, op_ana_B,    1, 4,  4,  0, "ANA",  "B",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xa1, op_ana_C,    1, 4,  4,  0, "ANA",  "C",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xa2, op_ana_D,    1, 4,  4,  0, "ANA",  "D",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xa3, op_ana_E,    1, 4,  4,  0, "ANA",  "E",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xa4, op_ana_H,    1, 4,  4,  0, "ANA",  "H",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xa5, op_ana_L,    1, 4,  4,  0, "ANA",  "L",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xa6, op_ana_M,    1, 7,  7,  0, "ANA",  "M",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xa7, op_ana_A,    1, 4,  4,  0, "ANA",  "A",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xa8, op_xra_B,    1, 4,  4,  0, "XRA",  "B",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xa9, op_xra_C,    1, 4,  4,  0, "XRA",  "C",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xaa, op_xra_D,    1, 4,  4,  0, "XRA",  "D",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xab, op_xra_E,    1, 4,  4,  0, "XRA",  "E",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xac, op_xra_H,    1, 4,  4,  0, "XRA",  "H",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xad, op_xra_L,    1, 4,  4,  0, "XRA",  "L",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xae, op_xra_M,    1, 7,  7,  0, "XRA",  "M",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xaf, op_xra_A,    1, 4,  4,  0, "XRA",  "A",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb0, op_ora_B,    1, 4,  4,  0, "ORA",  "B",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb1, op_ora_C,    1, 4,  4,  0, "ORA",  "C",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb2, op_ora_D,    1, 4,  4,  0, "ORA",  "D",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb3, op_ora_E,    1, 4,  4,  0, "ORA",  "E",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb4, op_ora_H,    1, 4,  4,  0, "ORA",  "H",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb5, op_ora_L,    1, 4,  4,  0, "ORA",  "L",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb6, op_ora_M,    1, 7,  7,  0, "ORA",  "M",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb7, op_ora_A,    1, 4,  4,  0, "ORA",  "A",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb8, op_cmp_B,    1, 4,  4,  0, "CMP",  "B",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xb9, op_cmp_C,    1, 4,  4,  0, "CMP",  "C",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xba, op_cmp_D,    1, 4,  4,  0, "CMP",  "D",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xbb, op_cmp_E,    1, 4,  4,  0, "CMP",  "E",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xbc, op_cmp_H,    1, 4,  4,  0, "CMP",  "H",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xbd, op_cmp_L,    1, 4,  4,  0, "CMP",  "L",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xbe, op_cmp_M,    1, 7,  7,  0, "CMP",  "M",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xbf, op_cmp_A,    1, 4,  4,  0, "CMP",  "A",   OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xc0, op_rNZ,      1, 5,  11, 0, "RNZ",  "",    OPERAND_NONE, FLAG_Z,            0) \
+    X(0xc1, op_pop_B,    1, 10, 10, 0, "POP",  "B",   OPERAND_NONE, 0,                 0) \
+    X(0xc2, op_jNZ,      3, 10, 10, 0, "JNZ",  "",    OPERAND_ADR,  FLAG_Z,            0) \
+    X(0xc3, op_jmp,      3, 10, 10, 0, "JMP",  "",    OPERAND_ADR,  0,                 0) \
+    X(0xc4, op_cNZ,      3, 11, 17, 0, "CNZ",  "",    OPERAND_ADR,  FLAG_Z,            0) \
+    X(0xc5, op_push_B,   1, 11, 11, 0, "PUSH", "B",   OPERAND_NONE, 0,                 0) \
+    X(0xc6, op_add_imm,  2, 7,  7,  0, "ADI",  "",    OPERAND_D8,   0,                 FLAGS_ALL) \
+    X(0xc7, op_rst_0,    1, 11, 11, 0, "RST",  "0",   OPERAND_NONE, 0,                 0) \
+    X(0xc8, op_rZ,       1, 5,  11, 0, "RZ",   "",    OPERAND_NONE, FLAG_Z,            0) \
+    X(0xc9, op_ret,      1, 10, 10, 0, "RET",  "",    OPERAND_NONE, 0,                 0) \
+    X(0xca, op_jZ,       3, 10, 10, 0, "JZ",   "",    OPERAND_ADR,  FLAG_Z,            0) \
+    X(0xcb, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0xcc, op_cZ,       3, 11, 17, 0, "CZ",   "",    OPERAND_ADR,  FLAG_Z,            0) \
+    X(0xcd, op_call,     3, 17, 17, 0, "CALL", "",    OPERAND_ADR,  0,                 0) \
+    X(0xce, op_adc_imm,  2, 7,  7,  0, "ACI",  "",    OPERAND_D8,   FLAG_CY,           FLAGS_ALL) \
+    X(0xcf, op_rst_1,    1, 11, 11, 0, "RST",  "1",   OPERAND_NONE, 0,                 0) \
+    X(0xd0, op_rNC,      1, 5,  11, 0, "RNC",  "",    OPERAND_NONE, FLAG_CY,           0) \
+    X(0xd1, op_pop_D,    1, 10, 10, 0, "POP",  "D",   OPERAND_NONE, 0,                 0) \
+    X(0xd2, op_jNC,      3, 10, 10, 0, "JNC",  "",    OPERAND_ADR,  FLAG_CY,           0) \
+    X(0xd3, op_out,      2, 10, 10, 1, "OUT",  "",    OPERAND_D8,   0,                 0) \
+    X(0xd4, op_cNC,      3, 11, 17, 0, "CNC",  "",    OPERAND_ADR,  FLAG_CY,           0) \
+    X(0xd5, op_push_D,   1, 11, 11, 0, "PUSH", "D",   OPERAND_NONE, 0,                 0) \
+    X(0xd6, op_sub_imm,  2, 7,  7,  0, "SUI",  "",    OPERAND_D8,   0,                 FLAGS_ALL) \
+    X(0xd7, op_rst_2,    1, 11, 11, 0, "RST",  "2",   OPERAND_NONE, 0,                 0) \
+    X(0xd8, op_rC,       1, 5,  11, 0, "RC",   "",    OPERAND_NONE, FLAG_CY,           0) \
+    X(0xd9, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0xda, op_jC,       3, 10, 10, 0, "JC",   "",    OPERAND_ADR,  FLAG_CY,           0) \
+    X(0xdb, op_in,       2, 10, 10, 0, "IN",   "",    OPERAND_D8,   0,                 0) \
+    X(0xdc, op_cC,       3, 11, 17, 0, "CC",   "",    OPERAND_ADR,  FLAG_CY,           0) \
+    X(0xdd, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0xde, op_sbb_imm,  2, 7,  7,  0, "SBI",  "",    OPERAND_D8,   FLAG_CY,           FLAGS_ALL) \
+    X(0xdf, op_rst_3,    1, 11, 11, 0, "RST",  "3",   OPERAND_NONE, 0,                 0) \
+    X(0xe0, op_rPO,      1, 5,  11, 0, "RPO",  "",    OPERAND_NONE, FLAG_P,            0) \
+    X(0xe1, op_pop_H,    1, 10, 10, 0, "POP",  "H",   OPERAND_NONE, 0,                 0) \
+    X(0xe2, op_jPO,      3, 10, 10, 0, "JPO",  "",    OPERAND_ADR,  FLAG_P,            0) \
+    X(0xe3, op_xthl,     1, 18, 18, 0, "XTHL", "",    OPERAND_NONE, 0,                 0) \
+    X(0xe4, op_cPO,      3, 11, 17, 0, "CPO",  "",    OPERAND_ADR,  FLAG_P,            0) \
+    X(0xe5, op_push_H,   1, 11, 11, 0, "PUSH", "H",   OPERAND_NONE, 0,                 0) \
+    X(0xe6, op_ana_imm,  2, 7,  7,  0, "ANI",  "",    OPERAND_D8,   0,                 FLAGS_ALL) \
+    X(0xe7, op_rst_4,    1, 11, 11, 0, "RST",  "4",   OPERAND_NONE, 0,                 0) \
+    X(0xe8, op_rPE,      1, 5,  11, 0, "RPE",  "",    OPERAND_NONE, FLAG_P,            0) \
+    X(0xe9, op_pchl,     1, 5,  5,  0, "PCHL", "",    OPERAND_NONE, 0,                 0) \
+    X(0xea, op_jPE,      3, 10, 10, 0, "JPE",  "",    OPERAND_ADR,  FLAG_P,            0) \
+    X(0xeb, op_xchg,     1, 5,  5,  0, "XCHG", "",    OPERAND_NONE, 0,                 0) \
+    X(0xec, op_cPE,      3, 11, 17, 0, "CPE",  "",    OPERAND_ADR,  FLAG_P,            0) \
+    X(0xed, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0xee, op_xra_imm,  2, 7,  7,  0, "XRI",  "",    OPERAND_D8,   0,                 FLAGS_ALL) \
+    X(0xef, op_rst_5,    1, 11, 11, 0, "RST",  "5",   OPERAND_NONE, 0,                 0) \
+    X(0xf0, op_rP,       1, 5,  11, 0, "RP",   "",    OPERAND_NONE, FLAG_S,            0) \
+    X(0xf1, op_pop_psw,  1, 10, 10, 0, "POP",  "PSW", OPERAND_NONE, 0,                 FLAGS_ALL) \
+    X(0xf2, op_jP,       3, 10, 10, 0, "JP",   "",    OPERAND_ADR,  FLAG_S,            0) \
+    X(0xf3, op_di,       1, 4,  4,  0, "DI",   "",    OPERAND_NONE, 0,                 0) \
+    X(0xf4, op_cP,       3, 11, 17, 0, "CP",   "",    OPERAND_ADR,  FLAG_S,            0) \
+    X(0xf5, op_push_psw, 1, 11, 11, 0, "PUSH", "PSW", OPERAND_NONE, FLAGS_ALL,         0) \
+    X(0xf6, op_ora_imm,  2, 7,  7,  0, "ORI",  "",    OPERAND_D8,   0,                 FLAGS_ALL) \
+    X(0xf7, op_rst_6,    1, 11, 11, 0, "RST",  "6",   OPERAND_NONE, 0,                 0) \
+    X(0xf8, op_rM,       1, 5,  11, 0, "RM",   "",    OPERAND_NONE, FLAG_S,            0) \
+    X(0xf9, op_sphl,     1, 5,  5,  0, "SPHL", "",    OPERAND_NONE, 0,                 0) \
+    X(0xfa, op_jM,       3, 10, 10, 0, "JM",   "",    OPERAND_ADR,  FLAG_S,            0) \
+    X(0xfb, op_ei,       1, 4,  4,  0, "EI",   "",    OPERAND_NONE, 0,                 0) \
+    X(0xfc, op_cM,       3, 11, 17, 0, "CM",   "",    OPERAND_ADR,  FLAG_S,            0) \
+    X(0xfd, op_nop,      1, 4,  4,  0, "NOP",  "",    OPERAND_NONE, 0,                 0) \
+    X(0xfe, op_cmp_imm,  2, 7,  7,  0, "CPI",  "",    OPERAND_D8,   0,                 FLAGS_ALL) \
+    X(0xff, op_rst_7,    1, 11, 11, 0, "RST",  "7",   OPERAND_NONE, 0,                 0)
+
+#endif //_OPCODES_H
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "opcodes.h"
+
+/*
+    Static recompiler: translates a ROM image, loaded from the files
+    given (one after another from address 0, as emu8080 loads them),
+    into C for the CPU core. The code is found by following every jump,
+    call and return address from the reset and RST vectors, and each
+    basic block of it becomes a labelled run of calls to the handler for
+    each instruction, in one function that goes straight on to the
+    blocks that follow it (see the Ahead-of-time translation section of
+    cpu.c). The output includes cpu.c, and is built in its place.
+*/
+
+#define ADDRESS_SPACE 0x10000
+
+#define NAME_ENTRY(code, handler, ...) [code] = #handler,
+#define LEN_ENTRY(code, handler, len, ...) [code] = len,
+#define CYCLES_ENTRY(code, handler, len, cycles, ...) [code] = cycles,
+#define STOP_ENTRY(code, handler, len, cycles, taken, stop, ...) [code] = stop,
+static const char *const handler_name[256] = { OPCODE_TABLE(NAME_ENTRY) };
+static const int oplen[256] = { OPCODE_TABLE(LEN_ENTRY) };
+static const int opcycles[256] = { OPCODE_TABLE(CYCLES_ENTRY) };
+static const int opstop[256] = { OPCODE_TABLE(STOP_ENTRY) };
+
+//(with room for the operands of an instruction at the very end)
+static uint8_t image[ADDRESS_SPACE + 2];
+static int image_size;
+
+//instructions found, by the address of their first byte, and the
+//addresses basic blocks start at
+static uint8_t is_code[ADDRESS_SPACE];
+static uint8_t is_leader[ADDRESS_SPACE];
+
+//whether the instruction is a jump, call, return or RST
+static int is_branch(uint8_t op) {
+    return (op & 0xc7) == 0xc0 || (op & 0xc7) == 0xc2 ||
+           (op & 0xc7) == 0xc4 || (op & 0xc7) == 0xc7 ||
+           op == 0xc3 || op == 0xc9 || op == 0xcd || op == 0xe9;
+}
+
+//whether the instruction at adr is inside the image
+static int in_image(int adr) {
+    return adr < image_size && adr + oplen[image[adr]] <= image_size;
+}
+
+static int worklist[ADDRESS_SPACE];
+static int nwork;
+
+static void add_leader(int adr) {
+    if (!in_image(adr) || is_leader[adr]) return;
+    is_leader[adr] = 1;
+    worklist[nwork++] = adr;
+}
+
+//follow the code from adr until it leaves by a jump or return
+static void trace(int adr) {
+    while (in_image(adr) && !is_code[adr]) {
+        uint8_t op = image[adr];
+        int target = image[adr + 2] << 8 | image[adr + 1];
+        int next = adr + oplen[op];
+        if (op == 0x76) return; //HLT is left to the interpreter
+        is_code[adr] = 1;
+        if (op == 0xc3) { //JMP
+            add_leader(target);
+            return;
+        }
+        if (op == 0xc9 || op == 0xe9) return; //RET, PCHL
+        if ((op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4 || op == 0xcd)
+            add_leader(target); //Jcc, Ccc, CALL
+        if ((op & 0xc7) == 0xc7) add_leader(op & 0x38); //RST
+        if (is_branch(op) || opstop[op]) add_leader(next);
+        adr = next;
+    }
+}
+
+//whether the basic block starting at start goes on past adr
+static int block_continues(int start, int adr) {
+    uint8_t op = image[adr];
+    int next = adr + oplen[op];
+    if (is_branch(op) || opstop[op]) return 0;
+    return next < image_size && is_code[next] && !is_leader[next] &&
+           image[next] != 0x76 && (next >> 8) == (start >> 8) &&
+           ((next + oplen[image[next]] - 1) >> 8) == (start >> 8);
+}
+
+//whether a block is translated from adr: it has to start with an
+//instruction that is all in one page
+static int starts_block(int adr) {
+    return is_leader[adr] && is_code[adr] &&
+           (adr + oplen[image[adr]] - 1) >> 8 == adr >> 8;
+}
+
+//the addresses the block ending with the instruction at adr can go
+//on to that are known ahead of time, returning how many
+static int successors(int adr, int *next) {
+    uint8_t op = image[adr];
+    int target = image[adr + 2] << 8 | image[adr + 1], n = 0;
+    if (op == 0xc3 || op == 0xcd || (op & 0xc7) == 0xc2 ||
+        (op & 0xc7) == 0xc4)
+        next[n++] = target;
+    if ((op & 0xc7) == 0xc7) next[n++] = op & 0x38;
+    if (op != 0xc3 && op != 0xcd && op != 0xc9 && op != 0xe9 &&
+        (op & 0xc7) != 0xc7)
+        next[n++] = adr + oplen[op];
+    return n;
+}
+
+//write out the basic block starting at start
+static void emit_block(FILE *out, int start) {
+    int cycles = 0, adr = start;
+    while (block_continues(start, adr)) adr += oplen[image[adr]];
+    for (int a = start; a < adr; a += oplen[image[a]])
+        cycles += opcycles[image[a]];
+    fprintf(out, "AOT_BLOCK(%04x, 0x%02x, %d)\n", start, start >> 8, cycles);
+    for (adr = start; block_continues(start, adr); adr += oplen[image[adr]])
+        fprintf(out, "    AOT_OP(%s, 0x%02x, 0x%02x, 0x%02x)\n",
+                handler_name[image[adr]], image[adr], image[adr + 1],
+                image[adr + 2]);
+    fprintf(out, "    AOT_LAST(0x%04x, %d, %s, 0x%02x, 0x%02x, 0x%02x)\n", adr,
+            cycles, handler_name[image[adr]], image[adr], image[adr + 1],
+            image[adr + 2]);
+    int next[2], n = successors(adr, next);
+    for (int i = 0; i < n; i++)
+        if (next[i] < image_size && starts_block(next[i]))
+            fprintf(out, "    AOT_NEXT(%04x)\n", next[i]);
+    fprintf(out, "    AOT_DISPATCH\n\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <output C file> <ROM files>\n", argv[0]);
+        return 1;
+    }
+
+    for (int fidx = 2; fidx < argc; fidx++) {
+        FILE *f = fopen(argv[fidx], "rb");
+        if (f == NULL) {
+            fprintf(stderr, "Failed to open ROM file %s\n", argv[fidx]);
+            return 1;
+        }
+        image_size += fread(image + image_size, 1, ADDRESS_SPACE - image_size, f);
+        fclose(f);
+    }
+
+    //the code reachable from reset and the RST vectors (interrupts)
+    for (int vector = 0; vector < 0x40; vector += 8) add_leader(vector);
+    while (nwork > 0) trace(worklist[--nwork]);
+
+    FILE *out = fopen(argv[1], "w");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open output file %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(out, "//generated by recomp8080 from");
+    for (int fidx = 2; fidx < argc; fidx++) fprintf(out, " %s", argv[fidx]);
+    fprintf(out, "\n//do not edit\n\n");
+    fprintf(out, "#define CPU_AOT\n#include \"cpu.c\"\n#include <string.h>\n\n");
+
+    fprintf(out, "static const byte aot_image[%d] = {", image_size);
+    for (int adr = 0; adr < image_size; adr++)
+        fprintf(out, "%s0x%02x,", adr % 12 ? " " : "\n    ", image[adr]);
+    fprintf(out, "\n};\n\n");
+    fprintf(out, "static int aot_image_loaded(CPUState *state) {\n");
+    fprintf(out, "    return memcmp(state->memory, aot_image, sizeof(aot_image)) == 0;\n");
+    fprintf(out, "}\n\n");
+
+    int nblocks = 0;
+    fprintf(out, "static int aot_run(CPUState *cs, int cycle_budget) {\n");
+    fprintf(out, "    AOT_PROLOGUE\n");
+    fprintf(out, "    switch (state->pc) {\n");
+    for (int adr = 0; adr < image_size; adr++)
+        if (starts_block(adr)) {
+            fprintf(out, "        case 0x%04x: goto aot_%04x;\n", adr, adr);
+            nblocks++;
+        }
+    fprintf(out, "    }\n");
+    fprintf(out, "    AOT_INTERPRET\n\n");
+    for (int adr = 0; adr < image_size; adr++)
+        if (starts_block(adr)) emit_block(out, adr);
+    fprintf(out, "    AOT_EPILOGUE\n}\n");
+    fclose(out);
+
+    fprintf(stderr, "%d bytes, %d basic blocks\n", image_size, nblocks);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#include "scheduler.h"
+
+void initScheduler(Scheduler *s) {
+    s->now = 0;
+    s->nevents = 0;
+}
+
+int scheduleEvent(Scheduler *s, uint64_t when, EventHandler handler,
+                  void *ctx) {
+    if (s->nevents == SCHEDULER_EVENTS) return 0;
+    //move the events due no later than this one up past it
+    int i = s->nevents++;
+    while (i > 0 && s->events[i - 1].when <= when) {
+        s->events[i] = s->events[i - 1];
+        i--;
+    }
+    s->events[i] = (Event) {when, handler, ctx};
+    return 1;
+}
+
+uint64_t nextEventTime(const Scheduler *s) {
+    if (s->nevents == 0) return UINT64_MAX;
+    return s->events[s->nevents - 1].when;
+}
+
+void runEvents(Scheduler *s) {
+    while (s->nevents > 0 && s->events[s->nevents - 1].when <= s->now) {
+        //(taken off first, so the handler can schedule it again)
+        Event e = s->events[--s->nevents];
+        e.handler(e.ctx, e.when);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <stdint.h>
+
+/*
+    Cycle-timed events for the machine layer. The scheduler keeps a
+    64-bit count of the cycles the CPU has run, which the host adds to
+    as it runs it, and a queue of callbacks due at absolute cycle times.
+    The host runs the CPU straight up to the next event, then calls
+    runEvents, so nothing is checked between instructions, and events
+    that come late (as runCPU can overshoot a deadline by part of an
+    instruction) are caught up on without moving the ones after them.
+*/
+
+//called with the cycle time the event was due at, which a periodic
+//event adds its period to to schedule itself again
+typedef void (*EventHandler)(void *ctx, uint64_t when);
+
+typedef struct Event {
+    uint64_t when;
+    EventHandler handler;
+    void *ctx;
+} Event;
+
+#define SCHEDULER_EVENTS 16
+
+typedef struct Scheduler {
+    uint64_t now; //cycles run
+    int nevents;
+    //latest first, so the next event due is at the end
+    Event events[SCHEDULER_EVENTS];
+} Scheduler;
+
+//start the clock at 0 with no events
+void initScheduler(Scheduler *s);
+
+//have handler called with ctx once the clock reaches when (after any
+//events already due at the same time). returns 0 if the queue is full.
+int scheduleEvent(Scheduler *s, uint64_t when, EventHandler handler,
+                  void *ctx);
+
+//the cycle time of the next event, or UINT64_MAX if there isn't one
+uint64_t nextEventTime(const Scheduler *s);
+
+//call the handlers of the events that are due, in the order they are
+//due, including any they schedule for no later than now
+void runEvents(Scheduler *s);
+
+#endif //_SCHEDULER_H
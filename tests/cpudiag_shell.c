@@ -1,5 +1,6 @@
 #include "cpu.h"
 #include <stdio.h>
+#include <string.h>
 
 /*
     Emulator shell specifically to run the CPU diagnostics binary file.
@@ -7,11 +8,21 @@
     CPU emulation.
     Use this as an integration test for the CPU emulation. Requires assembled
     CPUDIAG program for the 8080 from: www.emulator101.com/files/cpudiag.bin
+    With -c, the decode cache is started off from the file given, if it
+    was saved from the same program, and saved back to it at the end.
 */
 
 int main(int argc, char **argv) {
+    const char *cache_file = NULL;
+    if (argc == 4 && strcmp(argv[1], "-c") == 0) {
+        cache_file = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
     if (argc != 2) {
-        printf("Usage: %s <cpudiag binary file>\n", argv[0]);
+        printf("Usage: %s [-c <decode cache file>] <cpudiag binary file>\n",
+               argv[0]);
         return 1;
     }
 
@@ -32,39 +43,59 @@ int main(int argc, char **argv) {
     fread(cs->memory + 0x0100, sizeof(byte), fsize, bin_file);
     fclose(bin_file);
 
-    cs->memory[0] = 0x31;//lxi sp (for 8080PRE)
-    cs->memory[1] = 0x06;
-    cs->memory[2] = 0x00;
-    cs->memory[3] = 0xc3;//JMP to start of CP/M program
-    cs->memory[4] = 0x00;
-    cs->memory[5] = 0x01;
+    //CP/M zero page. Warm boot (JMP $0000) and the BDOS entry point
+    //at $0005 are both HLT, so runCPU hands control back to the shell
+    //whenever the program makes a system call or finishes.
+    cs->memory[0] = 0x76;
+    cs->memory[5] = 0x76;
     cs->memory[6] = 0xff;//this is the "stack pointer" address for 8080EX1
     cs->memory[7] = 0xff;
 
+    //start the CP/M program with a stack (8080PRE needs one) holding
+    //a return address to the warm boot vector, as the CCP would. it
+    //sits below the top of memory so that BDOS calls pushing their
+    //return address can't overwrite the traps in the zero page.
+    cs->sp = 0xff00;
+    cs->memory[cs->sp] = 0x00;
+    cs->memory[cs->sp+1] = 0x00;
+    cs->pc = 0x0100;
+    //run the program's loops as translated code, if the core has a JIT
+    enableJIT(cs);
+    if (cache_file) loadDecodeCache(cs, cache_file);
+
+    int status = 0;
     while (1) {
-        //catch print calls (code copied and modified from emulator101)
-        if (cs->memory[cs->pc] == 0xcd && cs->memory[cs->pc+1] == 0x05 && cs->memory[cs->pc+2] == 0x00) {
-            if (cs->reg[2] == 9) {
-                uint16_t offset = (cs->reg[3]<<8) | (cs->reg[4]);    
-                char *str = (char *) &cs->memory[offset];
-                while (*str != '$')
-                    printf("%c", *str++);
-                // printf("\n");
-            } else if (cs->reg[2] == 2) {
-                //accumulator is a single character (or maybe E register)
-                //(from cp/m programmers' manual here http://www.cpm.z80.de/manuals/cpm22-m.pdf)
-                printf("%c", cs->reg[4]);
-            }
-            //"return"
-            cs->pc += 3;
+        runCPU(cs, 1000000);
+        if (cs->trap != TRAP_NONE) {
+            fprintf(stderr, "CPU fault %d at %04x\n", cs->trap, cs->pc);
+            status = 1;
+            break;
+        }
+        //out of cycles, or stopped after an OUT
+        if (!cs->halted) continue;
+        //anything other than a BDOS call ends the program
+        if (cs->pc != 0x0005) break;
+        //emulate print calls (code copied and modified from emulator101)
+        if (cs->c == 9) {
+            uint16_t offset = cs->de;
+            char *str = (char *) &cs->memory[offset];
+            while (*str != '$')
+                printf("%c", *str++);
+            // printf("\n");
+        } else if (cs->c == 2) {
+            //accumulator is a single character (or maybe E register)
+            //(from cp/m programmers' manual here http://www.cpm.z80.de/manuals/cpm22-m.pdf)
+            printf("%c", cs->e);
         }
-        //catch JMP $0000 (restart called at end of program)
-        else if (cs->memory[cs->pc] == 0xc3 && (cs->memory[cs->pc+2] << 8 | cs->memory[cs->pc+1]) == 0) break;
-        else if (stepCPU(cs) == 0) break;
+        //return to the caller
+        cs->halted = 0;
+        cs->pc = cs->memory[cs->sp+1] << 8 | cs->memory[cs->sp];
+        cs->sp += 2;
     }
     printf("\n");
 
+    if (cache_file) saveDecodeCache(cs, cache_file);
     destroyState(cs);
 
-    return 0;
+    return status;
 }
@@ -1,6 +1,9 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "cpu.h"
+#include "opcodes.h"
 
 CPUState* cs;
 
@@ -34,10 +37,10 @@ END_TEST
 START_TEST (test_inr)
 {
     //increment single register
-    cs->reg[1] = 0x0e;
+    cs->b = 0x0e;
     cs->memory[0] = 0x04;
     ck_assert_int_eq(stepCPU(cs), 5);
-    ck_assert_int_eq(cs->reg[1], 0x0f);
+    ck_assert_int_eq(cs->b, 0x0f);
     ck_assert_int_eq(cs->fl.z, 0);
     ck_assert_int_eq(cs->fl.s, 0);
     ck_assert_int_eq(cs->fl.p, 1);
@@ -50,8 +53,8 @@ START_TEST (test_inr_mem)
 {
     cs->memory[0] = 0x34;
     cs->memory[0x0e36] = 0xff;
-    cs->reg[5] = 0x0e;
-    cs->reg[6] = 0x36;
+    cs->h = 0x0e;
+    cs->l = 0x36;
     ck_assert_int_eq(stepCPU(cs), 10);
     ck_assert_int_eq(cs->memory[0x0e36], 0x00);
     ck_assert_int_eq(cs->fl.z, 1);
@@ -65,9 +68,9 @@ END_TEST
 START_TEST (test_dcr)
 {
     cs->memory[0] = 0x05;
-    cs->reg[1] = 0xa2;
+    cs->b = 0xa2;
     ck_assert_int_eq(stepCPU(cs),5);
-    ck_assert_int_eq(cs->reg[1], 0xa1);
+    ck_assert_int_eq(cs->b, 0xa1);
     ck_assert_int_eq(cs->fl.z, 0);
     ck_assert_int_eq(cs->fl.s, 1);
     ck_assert_int_eq(cs->fl.p, 0);
@@ -80,8 +83,8 @@ START_TEST (test_dcr_mem)
 {
     cs->memory[0] = 0x35;
     cs->memory[0x0e36] = 0x00;
-    cs->reg[5] = 0x0e;
-    cs->reg[6] = 0x36;
+    cs->h = 0x0e;
+    cs->l = 0x36;
     ck_assert_int_eq(stepCPU(cs), 10);
     ck_assert_int_eq(cs->memory[0x0e36], 0xff);
     ck_assert_int_eq(cs->fl.z, 0);
@@ -95,9 +98,9 @@ END_TEST
 START_TEST (test_daa)
 {
     cs->memory[0] = 0x27;
-    cs->reg[0] = 0x9b;
+    cs->a = 0x9b;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x01);
+    ck_assert_int_eq(cs->a, 0x01);
     ck_assert_int_eq(cs->fl.z, 0);
     ck_assert_int_eq(cs->fl.s, 0);
     ck_assert_int_eq(cs->fl.p, 0);
@@ -109,9 +112,9 @@ END_TEST
 START_TEST (test_daa_no_change)
 {   
     cs->memory[0] = 0x27;
-    cs->reg[0] = 0x55;
+    cs->a = 0x55;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x55);
+    ck_assert_int_eq(cs->a, 0x55);
 }
 END_TEST
 
@@ -119,20 +122,20 @@ START_TEST (test_daa_carries)
 {
     //example from CPUDIAG
     cs->memory[0] = 0x27;
-    cs->reg[0] = 0x10;
+    cs->a = 0x10;
     cs->fl.cy = 1;
     cs->fl.ac = 1;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x76);
+    ck_assert_int_eq(cs->a, 0x76);
 }
 END_TEST
 
 START_TEST (test_cma)
 {
     cs->memory[0] = 0x2f;
-    cs->reg[0] = 0x55;
+    cs->a = 0x55;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0xaa);
+    ck_assert_int_eq(cs->a, 0xaa);
     //no flags affected
     ck_assert_int_eq(cs->fl.z, 0);
     ck_assert_int_eq(cs->fl.s, 0);
@@ -145,11 +148,11 @@ END_TEST
 START_TEST (test_mov)
 {
     cs->memory[0] = 0x41;
-    cs->reg[2] = 0x37;
+    cs->c = 0x37;
     //source unchanged, no flags affected
     ck_assert_int_eq(stepCPU(cs), 5);
-    ck_assert_int_eq(cs->reg[1], 0x37);
-    ck_assert_int_eq(cs->reg[2], 0x37);
+    ck_assert_int_eq(cs->b, 0x37);
+    ck_assert_int_eq(cs->c, 0x37);
     ck_assert_int_eq(cs->fl.z, 0);
     ck_assert_int_eq(cs->fl.s, 0);
     ck_assert_int_eq(cs->fl.p, 0);
@@ -162,10 +165,10 @@ START_TEST (test_mov_from_mem)
 {
     cs->memory[0] = 0x46;
     cs->memory[0x0f98] = 0x24;
-    cs->reg[5] = 0x0f;
-    cs->reg[6] = 0x98;
+    cs->h = 0x0f;
+    cs->l = 0x98;
     ck_assert_int_eq(stepCPU(cs), 7);
-    ck_assert_int_eq(cs->reg[1], 0x24);
+    ck_assert_int_eq(cs->b, 0x24);
     ck_assert_int_eq(cs->memory[0x0f98], 0x24);
 }
 END_TEST
@@ -173,11 +176,11 @@ END_TEST
 START_TEST (test_mov_to_mem)
 {
     cs->memory[0] = 0x70;
-    cs->reg[5] = 0x11;
-    cs->reg[6] = 0x22;
-    cs->reg[1] = 0xce;
+    cs->h = 0x11;
+    cs->l = 0x22;
+    cs->b = 0xce;
     ck_assert_int_eq(stepCPU(cs), 7);
-    ck_assert_int_eq(cs->reg[1], 0xce);
+    ck_assert_int_eq(cs->b, 0xce);
     ck_assert_int_eq(cs->memory[0x1122], 0xce);
 }
 END_TEST
@@ -185,12 +188,12 @@ END_TEST
 START_TEST (test_stax)
 {
     cs->memory[0] = 0x02;
-    cs->reg[0] = 0x4f;
-    cs->reg[1] = 0x20;
-    cs->reg[2] = 0xbb;
+    cs->a = 0x4f;
+    cs->b = 0x20;
+    cs->c = 0xbb;
     ck_assert_int_eq(stepCPU(cs), 7);
     ck_assert_int_eq(cs->memory[0x20bb], 0x4f);
-    ck_assert_int_eq(cs->reg[0], 0x4f);
+    ck_assert_int_eq(cs->a, 0x4f);
 }
 END_TEST
 
@@ -198,11 +201,11 @@ START_TEST (test_ldax)
 {
     cs->memory[0] = 0x1A;
     cs->memory[0x01b3] = 0xf4;
-    cs->reg[3] = 0x01;
-    cs->reg[4] = 0xb3;
+    cs->d = 0x01;
+    cs->e = 0xb3;
     ck_assert_int_eq(stepCPU(cs), 7);
     ck_assert_int_eq(cs->memory[0x01b3], 0xf4);
-    ck_assert_int_eq(cs->reg[0], 0xf4);
+    ck_assert_int_eq(cs->a, 0xf4);
 }
 END_TEST
 
@@ -210,33 +213,33 @@ START_TEST (test_basic_add)
 {
     //test an ADD instruction - set the accumulator to 1
     //and add 2. no fancy carries etc.
-    cs->reg[0] = 1;
-    cs->reg[1] = 2;
+    cs->a = 1;
+    cs->b = 2;
     //ADD B
     cs->memory[0] = 0x80;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 3);
+    ck_assert_int_eq(cs->a, 3);
 }
 END_TEST
 
 START_TEST (test_add_from_memory)
 {
     //store at address 3ff (1023)
-    cs->reg[0] = 1;
-    cs->reg[5] = 0x03;
-    cs->reg[6] = 0xff;
+    cs->a = 1;
+    cs->h = 0x03;
+    cs->l = 0xff;
 
     cs->memory[0] = 0x86;
     cs->memory[1023] = 2;
     ck_assert_int_eq(stepCPU(cs), 7);
-    ck_assert_int_eq(cs->reg[0], 3);
+    ck_assert_int_eq(cs->a, 3);
 }
 END_TEST
 
 START_TEST (test_add_carry)
 {
-    cs->reg[0] = 0xf0;
-    cs->reg[1] = 0x10;
+    cs->a = 0xf0;
+    cs->b = 0x10;
     cs->memory[0] = 0x80;
 
     ck_assert_int_eq(stepCPU(cs), 4);
@@ -246,8 +249,8 @@ END_TEST
 
 START_TEST (test_add_aux_carry)
 {
-    cs->reg[0] = 0x0f;
-    cs->reg[1] = 0x01;
+    cs->a = 0x0f;
+    cs->b = 0x01;
     cs->memory[0] = 0x80;
 
     ck_assert_int_eq(stepCPU(cs), 4);
@@ -257,8 +260,8 @@ END_TEST
 
 START_TEST (test_add_parity)
 {
-    cs->reg[0] = 0x2e;
-    cs->reg[1] = 0x6c;
+    cs->a = 0x2e;
+    cs->b = 0x6c;
     cs->memory[0] = 0x80;
 
     ck_assert_int_eq(stepCPU(cs), 4);
@@ -269,11 +272,11 @@ END_TEST
 START_TEST (test_adi)
 {
     //immediate add (two-byte instruction)
-    cs->reg[0] = 0x0f;
+    cs->a = 0x0f;
     cs->memory[0] = 0xc6;
     cs->memory[1] = 0xf0;
     ck_assert_int_eq(stepCPU(cs), 7);
-    ck_assert_int_eq(cs->reg[0], 0xff);
+    ck_assert_int_eq(cs->a, 0xff);
     ck_assert_int_eq(cs->pc, 2);
 }
 END_TEST
@@ -281,12 +284,12 @@ END_TEST
 START_TEST (test_adc_set)
 {
     //add using the carry bit
-    cs->reg[0] = 0x0f;
-    cs->reg[1] = 0xf0;
+    cs->a = 0x0f;
+    cs->b = 0xf0;
     cs->fl.cy = 1;
     cs->memory[0] = 0x88;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0);
+    ck_assert_int_eq(cs->a, 0);
     ck_assert_int_eq(cs->fl.cy, 1);
 }
 END_TEST
@@ -295,12 +298,12 @@ START_TEST (test_adc_reset)
 {
     //make sure the carry bit is reset if the result of ADC doesn't
     //result in a further carry
-    cs->reg[0] = 0x08;
-    cs->reg[1] = 0x07;
+    cs->a = 0x08;
+    cs->b = 0x07;
     cs->fl.cy = 1;
     cs->memory[0] = 0x88;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x10);
+    ck_assert_int_eq(cs->a, 0x10);
     ck_assert_int_eq(cs->fl.cy, 0);
 }
 END_TEST
@@ -308,22 +311,22 @@ END_TEST
 START_TEST (test_basic_sub)
 {
     //test the SUB instruction with 2 - 1
-    cs->reg[0] = 2;
-    cs->reg[1] = 1;
+    cs->a = 2;
+    cs->b = 1;
     //SUB B
     cs->memory[0] = 0x90;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 1);
+    ck_assert_int_eq(cs->a, 1);
 }
 END_TEST
 
 START_TEST (test_sub_zero)
 {
-    cs->reg[0] = 2;
-    cs->reg[1] = 0;
+    cs->a = 2;
+    cs->b = 0;
     cs->memory[0] = 0x90;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 2);
+    ck_assert_int_eq(cs->a, 2);
     ck_assert_int_eq(cs->fl.z, 0);
     ck_assert_int_eq(cs->fl.cy, 0);
 }
@@ -332,8 +335,8 @@ END_TEST
 START_TEST (test_sub_greater)
 {
     //number greater than acc should set the carry ("borrow") bit
-    cs->reg[0] = 0x0e;
-    cs->reg[1] = 0x12;
+    cs->a = 0x0e;
+    cs->b = 0x12;
     cs->memory[0] = 0x90;
     ck_assert_int_eq(stepCPU(cs), 4);
     ck_assert_int_eq(cs->fl.cy, 1);
@@ -344,18 +347,18 @@ END_TEST
 
 START_TEST (test_sub_self_reset) {
     //SUB A should reset the carry bit and clear the accumulator
-    cs->reg[0] = 0x3e;
+    cs->a = 0x3e;
     cs->memory[0] = 0x97;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0);
+    ck_assert_int_eq(cs->a, 0);
     ck_assert_int_eq(cs->fl.cy, 0);
 }
 END_TEST
 
 START_TEST (test_sub_aux_carry) {
     //aux flag works same way as adding.
-    cs->reg[0] = 8;
-    cs->reg[1] = 1;
+    cs->a = 8;
+    cs->b = 1;
     cs->memory[0] = 0x90;
     ck_assert_int_eq(stepCPU(cs), 4);
     ck_assert_int_eq(cs->fl.ac, 1);
@@ -364,11 +367,11 @@ END_TEST
 
 START_TEST (test_subi) {
     //immediate sub
-    cs->reg[0] = 0xff;
+    cs->a = 0xff;
     cs->memory[0] = 0xd6;
     cs->memory[1] = 0x0f;
     ck_assert_int_eq(stepCPU(cs), 7);
-    ck_assert_int_eq(cs->reg[0], 0xf0);
+    ck_assert_int_eq(cs->a, 0xf0);
     ck_assert_int_eq(cs->pc, 2);
 }
 END_TEST
@@ -376,12 +379,12 @@ END_TEST
 START_TEST (test_sbb_set)
 {
     //sub with borrow, result still negative
-    cs->reg[0] = 0x07;
-    cs->reg[1] = 0x07;
+    cs->a = 0x07;
+    cs->b = 0x07;
     cs->fl.cy = 1;
     cs->memory[0] = 0x98;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0xff);
+    ck_assert_int_eq(cs->a, 0xff);
     ck_assert_int_eq(cs->fl.cy, 1);
 }
 END_TEST
@@ -389,23 +392,23 @@ END_TEST
 START_TEST (test_sbb_reset)
 {
     //sub with borrow, result now positive
-    cs->reg[0] = 0x11;
-    cs->reg[1] = 0x0f;
+    cs->a = 0x11;
+    cs->b = 0x0f;
     cs->fl.cy = 1;
     cs->memory[0] = 0x98;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x01);
+    ck_assert_int_eq(cs->a, 0x01);
     ck_assert_int_eq(cs->fl.cy, 0);
 }
 END_TEST
 
 START_TEST (test_ana)
 {
-    cs->reg[0] = 0xfc;
-    cs->reg[1] = 0x0f;
+    cs->a = 0xfc;
+    cs->b = 0x0f;
     cs->memory[0] = 0xa0;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x0c);
+    ck_assert_int_eq(cs->a, 0x0c);
     ck_assert_int_eq(cs->fl.cy, 0);
     ck_assert_int_eq(cs->fl.z, 0);
     ck_assert_int_eq(cs->fl.s, 0);
@@ -415,11 +418,11 @@ END_TEST
 
 START_TEST (test_xra)
 {
-    cs->reg[0] = 0x5c;
-    cs->reg[1] = 0x78;
+    cs->a = 0x5c;
+    cs->b = 0x78;
     cs->memory[0] = 0xa8;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x24);
+    ck_assert_int_eq(cs->a, 0x24);
     ck_assert_int_eq(cs->fl.cy, 0);
     ck_assert_int_eq(cs->fl.z, 0);
     ck_assert_int_eq(cs->fl.s, 0);
@@ -429,11 +432,11 @@ END_TEST
 
 START_TEST (test_ora)
 {
-    cs->reg[0] = 0x33;
-    cs->reg[1] = 0x0f;
+    cs->a = 0x33;
+    cs->b = 0x0f;
     cs->memory[0] = 0xb0;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x3f);
+    ck_assert_int_eq(cs->a, 0x3f);
     ck_assert_int_eq(cs->fl.cy, 0);
     ck_assert_int_eq(cs->fl.z, 0);
     ck_assert_int_eq(cs->fl.s, 0);
@@ -445,11 +448,11 @@ START_TEST (test_ora_a_ac_cy)
 {
     //ORA A will zero carry and aux carry
     cs->memory[0] = 0xb7;
-    cs->reg[0] = 0x55;
+    cs->a = 0x55;
     cs->fl.ac = 1;
     cs->fl.cy = 1;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x55);
+    ck_assert_int_eq(cs->a, 0x55);
     ck_assert_int_eq(cs->fl.cy, 0);
     ck_assert_int_eq(cs->fl.ac, 0);
 }
@@ -457,11 +460,11 @@ END_TEST
 
 START_TEST (test_cmp)
 {
-    cs->reg[0] = 0x02;
-    cs->reg[1] = 0x05;
+    cs->a = 0x02;
+    cs->b = 0x05;
     cs->memory[0] = 0xb8;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x02);
+    ck_assert_int_eq(cs->a, 0x02);
     ck_assert_int_eq(cs->fl.cy, 1);
     ck_assert_int_eq(cs->fl.z, 0);
 }
@@ -469,11 +472,11 @@ END_TEST
 
 START_TEST (test_cmp_opp_sign)
 {
-    cs->reg[0] = 0xe5;
-    cs->reg[1] = 0x05;
+    cs->a = 0xe5;
+    cs->b = 0x05;
     cs->memory[0] = 0xb8;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0xe5);
+    ck_assert_int_eq(cs->a, 0xe5);
     ck_assert_int_eq(cs->fl.cy, 0);
     ck_assert_int_eq(cs->fl.z, 0);
 }
@@ -482,9 +485,9 @@ END_TEST
 START_TEST (test_rlc)
 {
     cs->memory[0] = 0x07;
-    cs->reg[0] = 0xf2;
+    cs->a = 0xf2;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0xe5);
+    ck_assert_int_eq(cs->a, 0xe5);
     ck_assert_int_eq(cs->fl.cy, 1);
 }
 END_TEST
@@ -492,9 +495,9 @@ END_TEST
 START_TEST (test_rrc)
 {
     cs->memory[0] = 0x0f;
-    cs->reg[0] = 0xf2;
+    cs->a = 0xf2;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x79);
+    ck_assert_int_eq(cs->a, 0x79);
     ck_assert_int_eq(cs->fl.cy, 0);
 }
 END_TEST
@@ -502,9 +505,9 @@ END_TEST
 START_TEST (test_ral)
 {
     cs->memory[0] = 0x17;
-    cs->reg[0] = 0xb5;
+    cs->a = 0xb5;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0x6a);
+    ck_assert_int_eq(cs->a, 0x6a);
     ck_assert_int_eq(cs->fl.cy, 1);
 }
 END_TEST
@@ -512,10 +515,10 @@ END_TEST
 START_TEST (test_rar)
 {
     cs->memory[0] = 0x1f;
-    cs->reg[0] = 0x6a;
+    cs->a = 0x6a;
     cs->fl.cy = 1;
     ck_assert_int_eq(stepCPU(cs), 4);
-    ck_assert_int_eq(cs->reg[0], 0xb5);
+    ck_assert_int_eq(cs->a, 0xb5);
     ck_assert_int_eq(cs->fl.cy, 0);
 }
 END_TEST
@@ -529,8 +532,8 @@ START_TEST (test_push)
     //set it ourselves.
     cs->sp = 8192;
     cs->memory[0] = 0xc5;
-    cs->reg[1] = 0x11;
-    cs->reg[2] = 0x22;
+    cs->b = 0x11;
+    cs->c = 0x22;
     int old_sp = cs->sp;
     ck_assert_int_eq(stepCPU(cs), 11);
     ck_assert_int_eq(old_sp - cs->sp, 2);
@@ -546,7 +549,7 @@ START_TEST (test_push_psw)
     cs->fl.cy = 1;
     cs->fl.z = 1;
     cs->fl.p = 1;
-    cs->reg[0] = 0x1f;
+    cs->a = 0x1f;
     int old_sp = cs->sp;
     ck_assert_int_eq(stepCPU(cs), 11);
     ck_assert_int_eq(old_sp - cs->sp, 2);
@@ -565,8 +568,8 @@ START_TEST (test_pop)
     int old_sp = cs->sp;
     ck_assert_int_eq(stepCPU(cs), 10);
     ck_assert_int_eq(cs->sp - old_sp, 2);
-    ck_assert_int_eq(cs->reg[1], 0x93);
-    ck_assert_int_eq(cs->reg[2], 0x3d);
+    ck_assert_int_eq(cs->b, 0x93);
+    ck_assert_int_eq(cs->c, 0x3d);
 }
 END_TEST
 
@@ -580,7 +583,7 @@ START_TEST (test_pop_psw)
     int old_sp = cs->sp;
     ck_assert_int_eq(stepCPU(cs), 10);
     ck_assert_int_eq(cs->sp - old_sp, 2);
-    ck_assert_int_eq(cs->reg[0], 0xff);
+    ck_assert_int_eq(cs->a, 0xff);
     ck_assert_int_eq(cs->fl.cy, 1);
     ck_assert_int_eq(cs->fl.p, 0);
     ck_assert_int_eq(cs->fl.ac, 0);
@@ -593,13 +596,13 @@ START_TEST (test_dad)
 {
     //HL is the "double accumulator"
     cs->memory[0] = 0x09;
-    cs->reg[1] = 0x33;
-    cs->reg[2] = 0x9f;
-    cs->reg[5] = 0xa1;
-    cs->reg[6] = 0x7b;
+    cs->b = 0x33;
+    cs->c = 0x9f;
+    cs->h = 0xa1;
+    cs->l = 0x7b;
     ck_assert_int_eq(stepCPU(cs), 10);
-    ck_assert_int_eq(cs->reg[6], 0x1a);
-    ck_assert_int_eq(cs->reg[5], 0xd5);
+    ck_assert_int_eq(cs->l, 0x1a);
+    ck_assert_int_eq(cs->h, 0xd5);
     ck_assert_int_eq(cs->fl.cy, 0);
 }
 END_TEST
@@ -608,11 +611,11 @@ START_TEST (test_dad_sp)
 {
     cs->memory[0] = 0x39;
     cs->sp = 0x339f;
-    cs->reg[5] = 0xd1;
-    cs->reg[6] = 0x7b;
+    cs->h = 0xd1;
+    cs->l = 0x7b;
     ck_assert_int_eq(stepCPU(cs), 10);
-    ck_assert_int_eq(cs->reg[6], 0x1a);
-    ck_assert_int_eq(cs->reg[5], 0x05);
+    ck_assert_int_eq(cs->l, 0x1a);
+    ck_assert_int_eq(cs->h, 0x05);
     ck_assert_int_eq(cs->fl.cy, 1);
 }
 END_TEST
@@ -620,11 +623,11 @@ END_TEST
 START_TEST (test_inx)
 {
     cs->memory[0] = 0x13;
-    cs->reg[3] = 0x38;
-    cs->reg[4] = 0xff;
+    cs->d = 0x38;
+    cs->e = 0xff;
     ck_assert_int_eq(stepCPU(cs), 5);
-    ck_assert_int_eq(cs->reg[3], 0x39);
-    ck_assert_int_eq(cs->reg[4], 0x00);
+    ck_assert_int_eq(cs->d, 0x39);
+    ck_assert_int_eq(cs->e, 0x00);
 }
 END_TEST
 
@@ -641,11 +644,11 @@ END_TEST
 START_TEST (test_dcx)
 {
     cs->memory[0] = 0x2b;
-    cs->reg[5] = 0x98;
-    cs->reg[6] = 0x00;
+    cs->h = 0x98;
+    cs->l = 0x00;
     ck_assert_int_eq(stepCPU(cs), 5);
-    ck_assert_int_eq(cs->reg[6], 0xff);
-    ck_assert_int_eq(cs->reg[5], 0x97);
+    ck_assert_int_eq(cs->l, 0xff);
+    ck_assert_int_eq(cs->h, 0x97);
 }
 END_TEST
 
@@ -662,15 +665,15 @@ END_TEST
 START_TEST (test_xchg)
 {
     cs->memory[0] = 0xeb;
-    cs->reg[3] = 0x11;
-    cs->reg[4] = 0x22;
-    cs->reg[5] = 0x33;
-    cs->reg[6] = 0x44;
+    cs->d = 0x11;
+    cs->e = 0x22;
+    cs->h = 0x33;
+    cs->l = 0x44;
     ck_assert_int_eq(stepCPU(cs), 5);
-    ck_assert_int_eq(cs->reg[3], 0x33);
-    ck_assert_int_eq(cs->reg[4], 0x44);
-    ck_assert_int_eq(cs->reg[5], 0x11);
-    ck_assert_int_eq(cs->reg[6], 0x22);
+    ck_assert_int_eq(cs->d, 0x33);
+    ck_assert_int_eq(cs->e, 0x44);
+    ck_assert_int_eq(cs->h, 0x11);
+    ck_assert_int_eq(cs->l, 0x22);
 }
 END_TEST
 
@@ -680,11 +683,11 @@ START_TEST (test_xthl)
     cs->sp = 8190;
     cs->memory[cs->sp] = 0x11;
     cs->memory[cs->sp + 1] = 0x22;
-    cs->reg[5] = 0x33;
-    cs->reg[6] = 0x44;
+    cs->h = 0x33;
+    cs->l = 0x44;
     ck_assert_int_eq(stepCPU(cs), 18);
-    ck_assert_int_eq(cs->reg[5], 0x22);
-    ck_assert_int_eq(cs->reg[6], 0x11);
+    ck_assert_int_eq(cs->h, 0x22);
+    ck_assert_int_eq(cs->l, 0x11);
     ck_assert_int_eq(cs->sp, 8190);
     ck_assert_int_eq(cs->memory[cs->sp], 0x44);
     ck_assert_int_eq(cs->memory[cs->sp+1], 0x33);
@@ -695,8 +698,8 @@ START_TEST (test_sphl)
 {
     cs->memory[0] = 0xf9;
     cs->sp = 0;
-    cs->reg[5] = 0x11;
-    cs->reg[6] = 0x22;
+    cs->h = 0x11;
+    cs->l = 0x22;
     ck_assert_int_eq(stepCPU(cs), 5);
     ck_assert_int_eq(cs->sp, 0x1122);
 }
@@ -708,8 +711,8 @@ START_TEST (test_lxi)
     cs->memory[1] = 0xab;
     cs->memory[2] = 0xcd;
     ck_assert_int_eq(stepCPU(cs), 10);
-    ck_assert_int_eq(cs->reg[5], 0xcd);
-    ck_assert_int_eq(cs->reg[6], 0xab);
+    ck_assert_int_eq(cs->h, 0xcd);
+    ck_assert_int_eq(cs->l, 0xab);
     ck_assert_int_eq(cs->pc, 3);
 }
 END_TEST
@@ -730,7 +733,7 @@ START_TEST (test_mvi)
     cs->memory[0] = 0x1e;
     cs->memory[1] = 0x5a;
     ck_assert_int_eq(stepCPU(cs), 7);
-    ck_assert_int_eq(cs->reg[4], 0x5a);
+    ck_assert_int_eq(cs->e, 0x5a);
     ck_assert_int_eq(cs->pc, 2);
 }
 END_TEST
@@ -739,8 +742,8 @@ START_TEST (test_mvi_mem)
 {
     cs->memory[0] = 0x36;
     cs->memory[1] = 0x7a;
-    cs->reg[5] = 0x1a;
-    cs->reg[6] = 0x2b;
+    cs->h = 0x1a;
+    cs->l = 0x2b;
     ck_assert_int_eq(stepCPU(cs), 10);
     ck_assert_int_eq(cs->memory[0x1a2b], 0x7a);
     ck_assert_int_eq(cs->pc, 2);
@@ -752,7 +755,7 @@ START_TEST (test_sta)
     cs->memory[0] = 0x32;
     cs->memory[1] = 0xb3;
     cs->memory[2] = 0x05;
-    cs->reg[0] = 0x12;
+    cs->a = 0x12;
     ck_assert_int_eq(stepCPU(cs), 13);
     ck_assert_int_eq(cs->memory[0x05b3], 0x12);
     ck_assert_int_eq(cs->pc, 3);
@@ -766,7 +769,7 @@ START_TEST (test_lda)
     cs->memory[2] = 0x05;
     cs->memory[0x05b3] = 0x12;
     ck_assert_int_eq(stepCPU(cs), 13);
-    ck_assert_int_eq(cs->reg[0], 0x12);
+    ck_assert_int_eq(cs->a, 0x12);
     ck_assert_int_eq(cs->pc, 3);
 }
 END_TEST
@@ -776,8 +779,8 @@ START_TEST (test_shld)
     cs->memory[0] = 0x22;
     cs->memory[1] = 0x0a;
     cs->memory[2] = 0x01;
-    cs->reg[5] = 0xae;
-    cs->reg[6] = 0x29;
+    cs->h = 0xae;
+    cs->l = 0x29;
     ck_assert_int_eq(stepCPU(cs), 16);
     ck_assert_int_eq(cs->memory[0x010a], 0x29);
     ck_assert_int_eq(cs->memory[0x010b], 0xae);
@@ -793,8 +796,8 @@ START_TEST (test_lhld)
     cs->memory[0x025b] = 0xff;
     cs->memory[0x025c] = 0x03;
     ck_assert_int_eq(stepCPU(cs), 16);
-    ck_assert_int_eq(cs->reg[5], 0x03);
-    ck_assert_int_eq(cs->reg[6], 0xff);
+    ck_assert_int_eq(cs->h, 0x03);
+    ck_assert_int_eq(cs->l, 0xff);
     ck_assert_int_eq(cs->pc, 3);
 }
 END_TEST
@@ -802,8 +805,8 @@ END_TEST
 START_TEST (test_pchl)
 {
     cs->memory[0] = 0xe9;
-    cs->reg[5] = 0x0b;
-    cs->reg[6] = 0x21;
+    cs->h = 0x0b;
+    cs->l = 0x21;
     ck_assert_int_eq(stepCPU(cs), 5);
     ck_assert_int_eq(cs->pc, 0x0b21);
 }
@@ -1269,13 +1272,13 @@ START_TEST (test_in)
     cs->memory[1] = 0x83;
     ck_assert_int_eq(stepCPU(cs), 10);
     ck_assert_int_eq(cs->pc, 2);
-    ck_assert_int_eq(cs->reg[0], 0xfe);
+    ck_assert_int_eq(cs->a, 0xfe);
 }
 END_TEST
 
 START_TEST (test_out)
 {
-    cs->reg[0] = 0xef;
+    cs->a = 0xef;
     cs->memory[0] = 0xd3;
     cs->memory[1] = 0x38;
     cs->memory[2] = 0x00;
@@ -1288,6 +1291,923 @@ START_TEST (test_out)
 }
 END_TEST
 
+//a device on ports 3 and 4 that adds up what it is sent, and gives
+//the number of times it has been read, counting 1 to 100 round again,
+//until the 1000th read, from which on it gives 0
+typedef struct PortDevice {
+    int reads, writes, sum;
+} PortDevice;
+
+static byte device_in(void *ctx, byte port) {
+    PortDevice *dev = ctx;
+    ck_assert_int_eq(port, 3);
+    return ++dev->reads < 1000 ? (dev->reads - 1) % 100 + 1 : 0;
+}
+
+static void device_out(void *ctx, byte port, byte val) {
+    PortDevice *dev = ctx;
+    ck_assert_int_eq(port, 4);
+    dev->writes++;
+    dev->sum += val;
+}
+
+//MVI C, 100; loop: IN 3; OUT 4; DCR C; JNZ loop; OUT 5; HLT
+static byte ports_prog[] = {
+    0x0e, 0x64, 0xdb, 0x03, 0xd3, 0x04, 0x0d, 0xc2, 0x02, 0x00,
+    0xd3, 0x05, 0x76
+};
+
+//run the loop, whose OUTs to the device don't stop runCPU, up to the
+//OUT to port 5, which has no handler and does
+static void check_ports(void) {
+    PortDevice dev = {0, 0, 0};
+    for (size_t i = 0; i < sizeof(ports_prog); i++)
+        cs->memory[i] = ports_prog[i];
+    cs->map->ctx = &dev;
+    mapPort(cs, 3, device_in, NULL);
+    mapPort(cs, 4, NULL, device_out);
+    ck_assert_int_eq(runCPU(cs, 100000), 7 + 100 * (10 + 10 + 5 + 10) + 10);
+    ck_assert_int_eq(cs->write_flag, 5);
+    ck_assert_int_eq(cs->pc, 0x0c);
+    ck_assert_int_eq(dev.reads, 100);
+    ck_assert_int_eq(dev.writes, 100);
+    ck_assert_int_eq(dev.sum, 100 * 101 / 2);
+    ck_assert_int_eq(cs->ports[4], 0);
+}
+
+START_TEST (test_port_handlers)
+{
+    check_ports();
+    //a loop waiting on a port with a handler isn't idle: every read is
+    //made. loop: IN 3; ANA A; JNZ loop; HLT
+    PortDevice dev = {0, 0, 0};
+    byte prog[] = {0xdb, 0x03, 0xa7, 0xc2, 0x00, 0x00, 0x76};
+    for (size_t i = 0; i < sizeof(prog); i++) cs->memory[i] = prog[i];
+    cs->map->ctx = &dev;
+    cs->pc = 0;
+    runCPU(cs, 100000);
+    ck_assert_int_eq(cs->pc, 6);
+    ck_assert_int_eq(dev.reads, 1000);
+}
+END_TEST
+
+START_TEST (test_run_budget)
+{
+    //MVI B; DCR B; JNZ back to the DCR; HLT
+    cs->memory[0] = 0x06;
+    cs->memory[1] = 0x03;
+    cs->memory[2] = 0x05;
+    cs->memory[3] = 0xc2;
+    cs->memory[4] = 0x02;
+    cs->memory[5] = 0x00;
+    cs->memory[6] = 0x76;
+    //MVI takes 7 cycles, so stops after the first DCR
+    ck_assert_int_eq(runCPU(cs, 8), 12);
+    ck_assert_int_eq(cs->pc, 3);
+    ck_assert_int_eq(cs->b, 0x02);
+    //runs the rest of the loop and the HLT, then idles out the budget
+    ck_assert_int_eq(runCPU(cs, 1000), 1000);
+    ck_assert_int_eq(cs->pc, 6);
+    ck_assert_int_eq(cs->halted, 1);
+    ck_assert_int_eq(cs->b, 0x00);
+    ck_assert_int_eq(cs->fl.z, 1);
+}
+END_TEST
+
+START_TEST (test_run_hlt)
+{
+    //INR A; HLT, with an RST 1 handler of INR A; RET
+    cs->sp = 0x1000;
+    cs->memory[0] = 0x3c;
+    cs->memory[1] = 0x76;
+    cs->memory[2] = 0x3c;
+    cs->memory[8] = 0x3c;
+    cs->memory[9] = 0xc9;
+    //INR A and HLT take 12 cycles, and the rest of the budget goes idle
+    ck_assert_int_eq(runCPU(cs, 10), 12);
+    ck_assert_int_eq(cs->pc, 1);
+    ck_assert_int_eq(cs->a, 0x01);
+    ck_assert_int_eq(cs->halted, 1);
+    ck_assert_int_eq(runCPU(cs, 1000), 1000);
+    ck_assert_int_eq(stepCPU(cs), 4);
+    ck_assert_int_eq(cs->pc, 1);
+    //an interrupt only wakes it if they are enabled
+    ck_assert_int_eq(interruptCPU(cs, 0xcf), 0);
+    ck_assert_int_eq(cs->halted, 1);
+    cs->int_enable = 1;
+    ck_assert_int_eq(interruptCPU(cs, 0xcf), 11);
+    ck_assert_int_eq(cs->halted, 0);
+    ck_assert_int_eq(cs->pc, 8);
+    //the handler returns past the HLT
+    ck_assert_int_eq(runCPU(cs, 20), 20);
+    ck_assert_int_eq(cs->pc, 3);
+    ck_assert_int_eq(cs->a, 0x03);
+    ck_assert_int_eq(cs->halted, 0);
+}
+END_TEST
+
+START_TEST (test_run_out)
+{
+    cs->a = 0x5a;
+    cs->memory[0] = 0xd3;
+    cs->memory[1] = 0x04;
+    cs->memory[2] = 0x3c;
+    ck_assert_int_eq(runCPU(cs, 1000), 10);
+    ck_assert_int_eq(cs->pc, 2);
+    ck_assert_int_eq(cs->ports[4], 0x5a);
+    ck_assert_int_eq(cs->write_flag, 0x04);
+    runCPU(cs, 1);
+    ck_assert_int_eq(cs->write_flag, -1);
+    ck_assert_int_eq(cs->a, 0x5b);
+}
+END_TEST
+
+START_TEST (test_run_superinstructions)
+{
+    //a loop made of the opcode pairs runCPU runs as superinstructions:
+    //whatever the budget, it has to stop where stepping would
+    byte prog[] = {
+        0x31, 0x00, 0x1f, //LXI SP, 0x1f00
+        0x21, 0x00, 0x10, //LXI H, 0x1000
+        0x11, 0x00, 0x11, //LXI D, 0x1100
+        0x06, 0x05,       //MVI B, 5
+        0xcd, 0x20, 0x00, //loop: CALL 0x0020
+        0x1a,             //LDAX D
+        0x13,             //INX D
+        0x77,             //MOV M, A
+        0x23,             //INX H
+        0xfe, 0x03,       //CPI 3
+        0xca, 0x18, 0x00, //JZ 0x0018
+        0x0c,             //INR C
+        0x05,             //DCR B
+        0xc2, 0x0b, 0x00, //JNZ loop
+        0x76,             //HLT
+        0, 0, 0,
+        0xc5,             //0x20: PUSH B
+        0xd5,             //PUSH D
+        0xe5,             //PUSH H
+        0x3c,             //INR A
+        0xe1,             //POP H
+        0xd1,             //POP D
+        0xc1,             //POP B
+        0xfb,             //EI
+        0xc9              //RET
+    };
+    for (int i = 0; i < (int) sizeof(prog); i++) cs->memory[i] = prog[i];
+    for (int i = 0; i < 5; i++) cs->memory[0x1100 + i] = i + 1;
+    for (int budget = 1; budget < 1000; budget++) {
+        CPUState *run = newState(8192), *step = newState(8192);
+        memcpy(run->memory, cs->memory, 8192);
+        memcpy(step->memory, cs->memory, 8192);
+        int cycles = runCPU(run, budget), step_cycles = 0;
+        while (step_cycles < budget && !step->halted)
+            step_cycles += stepCPU(step);
+        if (step_cycles < budget) step_cycles = budget;
+        ck_assert_int_eq(cycles, step_cycles);
+        ck_assert_int_eq(run->pc, step->pc);
+        ck_assert_int_eq(run->a, step->a);
+        ck_assert_int_eq(run->bc, step->bc);
+        ck_assert_int_eq(run->de, step->de);
+        ck_assert_int_eq(run->hl, step->hl);
+        ck_assert_int_eq(run->sp, step->sp);
+        ck_assert_int_eq(run->fl.psw, step->fl.psw);
+        ck_assert_int_eq(run->int_enable, step->int_enable);
+        destroyState(run);
+        destroyState(step);
+    }
+}
+END_TEST
+
+START_TEST (test_run_idle_loop)
+{
+    //loops waiting on memory, a port and nothing at all, which runCPU
+    //skips passes of: it still has to stop where stepping would, and
+    //leave them when the host changes what they wait on. the delay
+    //loop before them only reads too, but changes DE each time round.
+    byte prog[] = {
+        0x0e, 0x10,       //MVI C, 0x10
+        0x11, 0x00, 0x02, //LXI D, 0x0200
+        0x1b,             //DCX D
+        0x7a,             //MOV A, D
+        0xb3,             //ORA E
+        0xc2, 0x05, 0x00, //JNZ 0x0005
+        0x3a, 0x40, 0x00, //LDA 0x0040
+        0xa7,             //ANA A
+        0xca, 0x0b, 0x00, //JZ 0x000b
+        0xdb, 0x01,       //IN 1
+        0xe6, 0x01,       //ANI 1
+        0xca, 0x12, 0x00, //JZ 0x0012
+        0x0c,             //INR C
+        0xc3, 0x1a, 0x00  //JMP 0x001a
+    };
+    CPUState *run = newState(8192), *step = newState(8192);
+    for (int i = 0; i < (int) sizeof(prog); i++)
+        run->memory[i] = step->memory[i] = prog[i];
+    for (int round = 0; round < 60; round++) {
+        int budget = round < 50 ? round * 7 + 1 : 10000;
+        if (round == 53) run->memory[0x40] = step->memory[0x40] = 1;
+        if (round == 56) run->ports[1] = step->ports[1] = 1;
+        int cycles = runCPU(run, budget), step_cycles = 0;
+        while (step_cycles < budget) step_cycles += stepCPU(step);
+        ck_assert_int_eq(cycles, step_cycles);
+        ck_assert_int_eq(run->pc, step->pc);
+        ck_assert_int_eq(run->a, step->a);
+        ck_assert_int_eq(run->bc, step->bc);
+        ck_assert_int_eq(run->de, step->de);
+        ck_assert_int_eq(run->fl.psw, step->fl.psw);
+    }
+    ck_assert_int_eq(run->c, 0x11);
+    destroyState(run);
+    destroyState(step);
+}
+END_TEST
+
+START_TEST (test_step_table)
+{
+    //every opcode, with the flags all clear and then all set so that
+    //conditional branches go both ways, moves pc and counts cycles as
+    //the opcode table says
+    #define LEN(code, handler, len, ...) [code] = len,
+    #define CYCLES(code, handler, len, cycles, ...) [code] = cycles,
+    #define TAKEN(code, handler, len, cycles, taken, ...) [code] = taken,
+    static const int len[256] = { OPCODE_TABLE(LEN) };
+    static const int cycles[256] = { OPCODE_TABLE(CYCLES) };
+    static const int taken[256] = { OPCODE_TABLE(TAKEN) };
+    for (int op = 0; op < 256; op++) {
+        for (int set = 0; set < 2; set++) {
+            memset(cs->memory, 0, 8192);
+            cs->pc = 0x100;
+            cs->sp = 0x1800;
+            cs->h = 0x10;
+            cs->l = 0x00;
+            cs->fl.psw = set ? 0xff : 0x00;
+            cs->halted = 0;
+            cs->memory[0x100] = op;
+            cs->memory[0x101] = 0x00;
+            cs->memory[0x102] = 0x10;
+            cs->memory[0x1801] = 0x10;
+            int n = stepCPU(cs);
+            if (cs->pc == 0x100 + len[op])
+                ck_assert_int_eq(n, cycles[op]);
+            else
+                ck_assert_int_eq(n, taken[op]);
+        }
+    }
+}
+END_TEST
+
+//what the hooks of the instrumented core saw
+typedef struct Trace {
+    int fetches, breakpoint;
+    int nreads, nwrites, nbranches;
+    uint16_t reads[8], writes[8], branches[8][2];
+    byte in_port, in_val, out_port, out_val;
+} Trace;
+
+static int trace_fetch(void *ctx, CPUState *state, const byte *opcode) {
+    Trace *t = ctx;
+    (void) opcode;
+    t->fetches++;
+    return state->pc == t->breakpoint;
+}
+
+static void trace_read(void *ctx, uint16_t adr, byte val) {
+    Trace *t = ctx;
+    (void) val;
+    if (t->nreads < 8) t->reads[t->nreads++] = adr;
+}
+
+static void trace_write(void *ctx, uint16_t adr, byte val) {
+    Trace *t = ctx;
+    (void) val;
+    if (t->nwrites < 8) t->writes[t->nwrites++] = adr;
+}
+
+static void trace_in(void *ctx, byte port, byte val) {
+    ((Trace *) ctx)->in_port = port;
+    ((Trace *) ctx)->in_val = val;
+}
+
+static void trace_out(void *ctx, byte port, byte val) {
+    ((Trace *) ctx)->out_port = port;
+    ((Trace *) ctx)->out_val = val;
+}
+
+static void trace_branch(void *ctx, uint16_t from, uint16_t to) {
+    Trace *t = ctx;
+    if (t->nbranches == 8) return;
+    t->branches[t->nbranches][0] = from;
+    t->branches[t->nbranches++][1] = to;
+}
+
+//LDA 0x0100; CALL 0x0010; OUT 5; HLT, and at 0x0010 IN 7; RET
+static void load_traced(void) {
+    byte prog[] = {0x3a, 0x00, 0x01, 0xcd, 0x10, 0x00, 0xd3, 0x05, 0x76};
+    for (int i = 0; i < (int) sizeof(prog); i++) cs->memory[i] = prog[i];
+    cs->memory[0x10] = 0xdb;
+    cs->memory[0x11] = 0x07;
+    cs->memory[0x12] = 0xc9;
+    cs->memory[0x100] = 0x42;
+    cs->ports[7] = 0x99;
+    cs->sp = 0x1000;
+}
+
+START_TEST (test_run_hooks)
+{
+    Trace t = {.breakpoint = -1};
+    CPUHooks hooks = {trace_fetch, trace_read, trace_write, trace_in,
+                      trace_out, trace_branch, &t};
+    load_traced();
+    setCPUHooks(cs, &hooks);
+    //stopping after the OUT
+    ck_assert_int_eq(runCPU(cs, 1000), 13 + 17 + 10 + 10 + 10);
+    ck_assert_int_eq(cs->write_flag, 5);
+    ck_assert_int_eq(cs->pc, 0x08);
+    ck_assert_int_eq(t.fetches, 5);
+    //LDA, then the return address, which RET reads back
+    ck_assert_int_ge(t.nreads, 3);
+    ck_assert_int_eq(t.reads[0], 0x100);
+    ck_assert_int_eq(t.nwrites, 2);
+    ck_assert_int_eq(t.writes[0], 0x0fff);
+    ck_assert_int_eq(t.writes[1], 0x0ffe);
+    ck_assert_int_eq(t.in_port, 7);
+    ck_assert_int_eq(t.in_val, 0x99);
+    ck_assert_int_eq(t.out_port, 5);
+    ck_assert_int_eq(t.out_val, 0x99);
+    ck_assert_int_eq(t.nbranches, 2);
+    ck_assert_int_eq(t.branches[0][0], 0x03);
+    ck_assert_int_eq(t.branches[0][1], 0x10);
+    ck_assert_int_eq(t.branches[1][0], 0x12);
+    ck_assert_int_eq(t.branches[1][1], 0x06);
+    //HLT isn't a branch, but an interrupt is
+    runCPU(cs, 1000);
+    ck_assert_int_eq(t.fetches, 6);
+    ck_assert_int_eq(t.nbranches, 2);
+    cs->int_enable = 1;
+    ck_assert_int_eq(interruptCPU(cs, 0xcf), 11);
+    ck_assert_int_eq(t.nbranches, 3);
+    ck_assert_int_eq(t.branches[2][0], 0x09);
+    ck_assert_int_eq(t.branches[2][1], 0x08);
+    ck_assert_int_eq(t.nwrites, 4);
+    //and the plain core calls none of them
+    setCPUHooks(cs, NULL);
+    cs->pc = 0;
+    runCPU(cs, 1000);
+    ck_assert_int_eq(cs->pc, 0x08);
+    ck_assert_int_eq(t.fetches, 6);
+    ck_assert_int_eq(t.nwrites, 4);
+}
+END_TEST
+
+START_TEST (test_run_breakpoint)
+{
+    Trace t = {.breakpoint = 0x10};
+    CPUHooks hooks = {.fetch = trace_fetch, .ctx = &t};
+    load_traced();
+    enableDecodeCache(cs);
+    setCPUHooks(cs, &hooks);
+    //the fetch hook stops the run before IN, and stepCPU on it
+    ck_assert_int_eq(runCPU(cs, 1000), 13 + 17);
+    ck_assert_int_eq(cs->pc, 0x10);
+    ck_assert_int_eq(stepCPU(cs), 0);
+    ck_assert_int_eq(cs->pc, 0x10);
+    ck_assert_int_eq(cs->a, 0x42);
+    //until it is taken off, when the rest runs as before
+    setCPUHooks(cs, NULL);
+    ck_assert_int_eq(runCPU(cs, 1000), 10 + 10 + 10);
+    ck_assert_int_eq(cs->write_flag, 5);
+    ck_assert_int_eq(cs->a, 0x99);
+    ck_assert_int_eq(t.fetches, 4);
+}
+END_TEST
+
+START_TEST (test_top_of_memory)
+{
+    //JMP 0x0000 from the last three bytes of the address space
+    cs->memory[0xfffd] = 0xc3;
+    cs->memory[0xfffe] = 0x00;
+    cs->memory[0xffff] = 0x00;
+    cs->pc = 0xfffd;
+    ck_assert_int_eq(stepCPU(cs), 10);
+    ck_assert_int_eq(cs->pc, 0);
+    ck_assert_int_eq(cs->trap, TRAP_NONE);
+}
+END_TEST
+
+START_TEST (test_state_with_host)
+{
+    //the host's state comes zeroed, apart from memory and the rest of
+    //the CPU's, which start out as newState leaves them
+    CPUState *hs = newStateWithHost(0x10000, 100);
+    byte *host = hs->host;
+    ck_assert(cs->host == NULL);
+    ck_assert_int_eq((uintptr_t) hs % 64, 0);
+    for (int i = 0; i < 100; i++) ck_assert_int_eq(host[i], 0);
+    memset(host, 0xff, 100);
+    for (int i = 0; i < 0x10000; i++) ck_assert_int_eq(hs->memory[i], 0);
+    for (int i = 0; i < 256; i++) ck_assert_int_eq(hs->ports[i], 0);
+    ck_assert_int_eq(hs->fl.psw, 0x02);
+    ck_assert_int_eq(hs->write_flag, -1);
+    //SHLD 0xfffe writes the last two bytes of memory
+    hs->hl = 0x1234;
+    hs->memory[0] = 0x22;
+    hs->memory[1] = 0xfe;
+    hs->memory[2] = 0xff;
+    ck_assert_int_eq(stepCPU(hs), 16);
+    ck_assert_int_eq(hs->memory[0xffff], 0x12);
+    for (int i = 0; i < 100; i++) ck_assert_int_eq(host[i], 0xff);
+    destroyState(hs);
+}
+END_TEST
+
+#ifndef CPU_CHECKS
+START_TEST (test_wrap_push)
+{
+    cs->sp = 1;
+    cs->memory[0] = 0xc5;
+    cs->b = 0x12;
+    cs->c = 0x34;
+    ck_assert_int_eq(stepCPU(cs), 11);
+    ck_assert_int_eq(cs->sp, 0xffff);
+    ck_assert_int_eq(cs->memory[0xffff], 0x34);
+    ck_assert_int_eq(cs->memory[0x0000], 0x12);
+}
+END_TEST
+
+START_TEST (test_wrap_lhld)
+{
+    cs->memory[0] = 0x2a;
+    cs->memory[1] = 0xff;
+    cs->memory[2] = 0xff;
+    cs->memory[0xffff] = 0x78;
+    ck_assert_int_eq(stepCPU(cs), 16);
+    ck_assert_int_eq(cs->l, 0x78);
+    ck_assert_int_eq(cs->h, 0x2a);
+}
+END_TEST
+#else
+START_TEST (test_trap_stack_overflow)
+{
+    cs->sp = 1;
+    cs->memory[0] = 0xc5;
+    ck_assert_int_eq(stepCPU(cs), 0);
+    ck_assert_int_eq(cs->trap, TRAP_STACK_OVERFLOW);
+    ck_assert_int_eq(cs->pc, 0);
+    ck_assert_int_eq(cs->sp, 1);
+}
+END_TEST
+
+START_TEST (test_trap_bad_address)
+{
+    //NOP, then JMP past the end of RAM
+    cs->memory[1] = 0xc3;
+    cs->memory[2] = 0x00;
+    cs->memory[3] = 0x90;
+    ck_assert_int_eq(runCPU(cs, 1000), 4);
+    ck_assert_int_eq(cs->trap, TRAP_BAD_ADDRESS);
+    ck_assert_int_eq(cs->pc, 1);
+
+    //the trap is cleared once the host carries on
+    cs->memory[3] = 0x00;
+    ck_assert_int_eq(stepCPU(cs), 10);
+    ck_assert_int_eq(cs->trap, TRAP_NONE);
+    ck_assert_int_eq(cs->pc, 0);
+}
+END_TEST
+#endif
+
+//handlers for a memory-mapped device that remembers the last access
+static uint16_t mmio_adr;
+static byte mmio_val;
+
+static byte mmio_read(void *ctx, uint16_t adr) {
+    (void) ctx;
+    mmio_adr = adr;
+    return 0xa5;
+}
+
+static void mmio_write(void *ctx, uint16_t adr, byte val) {
+    (void) ctx;
+    mmio_adr = adr;
+    mmio_val = val;
+}
+
+START_TEST (test_map_rom)
+{
+    //STA 0x1010 into a page with no write memory or handler
+    mapPages(cs, 0x10, 1, &cs->memory[0x1000], NULL);
+    cs->memory[0x1010] = 0x42;
+    cs->memory[0] = 0x32;
+    cs->memory[1] = 0x10;
+    cs->memory[2] = 0x10;
+    cs->a = 0x99;
+    ck_assert_int_eq(stepCPU(cs), 13);
+    ck_assert_int_eq(cs->memory[0x1010], 0x42);
+}
+END_TEST
+
+START_TEST (test_map_mirror)
+{
+    //0x1e00-0x1eff mirrors 0x1000-0x10ff. STA 0x1e10, then LDA 0x1010
+    mapPages(cs, 0x1e, 1, &cs->memory[0x1000], &cs->memory[0x1000]);
+    cs->memory[0] = 0x32;
+    cs->memory[1] = 0x10;
+    cs->memory[2] = 0x1e;
+    cs->memory[3] = 0x3a;
+    cs->memory[4] = 0x10;
+    cs->memory[5] = 0x10;
+    cs->a = 0x99;
+    ck_assert_int_eq(stepCPU(cs), 13);
+    ck_assert_int_eq(cs->memory[0x1010], 0x99);
+    ck_assert_int_eq(cs->memory[0x1e10], 0x00);
+    cs->a = 0;
+    ck_assert_int_eq(stepCPU(cs), 13);
+    ck_assert_int_eq(cs->a, 0x99);
+}
+END_TEST
+
+START_TEST (test_map_handlers)
+{
+    mapPages(cs, 0x18, 1, NULL, NULL);
+    //MOV M, A then MOV B, M with HL in the unmapped page
+    cs->memory[0] = 0x77;
+    cs->memory[1] = 0x46;
+    cs->hl = 0x1834;
+    cs->a = 0x3c;
+
+    //with no handlers, writes are lost and reads give 0xff
+    ck_assert_int_eq(stepCPU(cs), 7);
+    ck_assert_int_eq(cs->memory[0x1834], 0x00);
+    ck_assert_int_eq(stepCPU(cs), 7);
+    ck_assert_int_eq(cs->b, 0xff);
+
+    cs->map->read_handler = mmio_read;
+    cs->map->write_handler = mmio_write;
+    cs->pc = 0;
+    ck_assert_int_eq(stepCPU(cs), 7);
+    ck_assert_int_eq(mmio_adr, 0x1834);
+    ck_assert_int_eq(mmio_val, 0x3c);
+    cs->hl = 0x18ff;
+    ck_assert_int_eq(stepCPU(cs), 7);
+    ck_assert_int_eq(mmio_adr, 0x18ff);
+    ck_assert_int_eq(cs->b, 0xa5);
+}
+END_TEST
+
+START_TEST (test_map_page_crossing)
+{
+    //LXI B at 0x10ff, whose operands are in a page mapped elsewhere
+    mapPages(cs, 0x11, 1, &cs->memory[0x3000], &cs->memory[0x3000]);
+    cs->memory[0x10ff] = 0x01;
+    cs->memory[0x3000] = 0x34;
+    cs->memory[0x3001] = 0x12;
+    cs->memory[0x3002] = 0x76;
+    cs->pc = 0x10ff;
+    ck_assert_int_eq(stepCPU(cs), 10);
+    ck_assert_int_eq(cs->bc, 0x1234);
+    ck_assert_int_eq(cs->pc, 0x1102);
+
+    cs->bc = 0;
+    cs->pc = 0x10ff;
+    ck_assert_int_eq(runCPU(cs, 8), 10);
+    ck_assert_int_eq(cs->bc, 0x1234);
+    ck_assert_int_eq(cs->pc, 0x1102);
+}
+END_TEST
+
+START_TEST (test_map_dirty)
+{
+    //0x1e00-0x1eff mirrors 0x1000-0x10ff. STA 0x1e10; PUSH B; HLT
+    byte dirty[256];
+    mapPages(cs, 0x1e, 1, &cs->memory[0x1000], &cs->memory[0x1000]);
+    cs->memory[0] = 0x32;
+    cs->memory[1] = 0x10;
+    cs->memory[2] = 0x1e;
+    cs->memory[3] = 0xc5;
+    cs->memory[4] = 0x76;
+    cs->a = 0x99;
+    cs->bc = 0x1234;
+    cs->sp = 0x1800;
+    trackDirtyPages(cs);
+    runCPU(cs, 100);
+    ck_assert_int_eq(cs->memory[0x1010], 0x99);
+    ck_assert_int_eq(cs->memory[0x17fe], 0x34);
+    ck_assert_int_eq(cs->memory[0x17ff], 0x12);
+    //the page written to, its mirror and the stack's page
+    ck_assert_int_eq(getDirtyPages(cs, dirty), 3);
+    ck_assert_int_eq(dirty[0x10], 1);
+    ck_assert_int_eq(dirty[0x1e], 1);
+    ck_assert_int_eq(dirty[0x17], 1);
+    //which getDirtyPages cleared
+    ck_assert_int_eq(getDirtyPages(cs, dirty), 0);
+    cs->halted = 0;
+    cs->pc = 3;
+    runCPU(cs, 100);
+    ck_assert_int_eq(getDirtyPages(cs, dirty), 1);
+    ck_assert_int_eq(dirty[0x17], 1);
+}
+END_TEST
+
+START_TEST (test_decode_patched_operand)
+{
+    //MVI A, 0x11; INR A; STA 0x0001; JMP 0x0000 - each pass stores the
+    //incremented value into the operand of the MVI
+    byte prog[] = {0x3e, 0x11, 0x3c, 0x32, 0x01, 0x00, 0xc3, 0x00, 0x00};
+    for (int i = 0; i < (int) sizeof(prog); i++) cs->memory[i] = prog[i];
+    enableDecodeCache(cs);
+    for (int i = 0; i < 8; i++) stepCPU(cs);
+    ck_assert_int_eq(cs->memory[1], 0x13);
+    ck_assert_int_eq(cs->a, 0x13);
+    ck_assert_int_eq(cs->pc, 0x0000);
+}
+END_TEST
+
+START_TEST (test_decode_patched_mirror)
+{
+    //0x1e00-0x1eff mirrors 0x1000-0x10ff. INR B; MVI A, 0x76; STA 0x1e00;
+    //JMP 0x1000 replaces the INR with a HLT through the mirror
+    byte prog[] = {0x04, 0x3e, 0x76, 0x32, 0x00, 0x1e, 0xc3, 0x00, 0x10};
+    mapPages(cs, 0x1e, 1, &cs->memory[0x1000], &cs->memory[0x1000]);
+    for (int i = 0; i < (int) sizeof(prog); i++) cs->memory[0x1000 + i] = prog[i];
+    cs->pc = 0x1000;
+    enableDecodeCache(cs);
+    for (int i = 0; i < 4; i++) stepCPU(cs);
+    ck_assert_int_eq(cs->b, 1);
+    ck_assert_int_eq(cs->pc, 0x1000);
+    stepCPU(cs);
+    ck_assert_int_eq(cs->b, 1);
+    ck_assert_int_eq(cs->pc, 0x1000);
+}
+END_TEST
+
+START_TEST (test_decode_flush)
+{
+    //INR B, then DCR B written by the host, which has to flush
+    cs->memory[0] = 0x04;
+    enableDecodeCache(cs);
+    ck_assert_int_eq(stepCPU(cs), 5);
+    ck_assert_int_eq(cs->b, 1);
+    cs->memory[0] = 0x05;
+    flushDecodeCache(cs);
+    cs->pc = 0;
+    ck_assert_int_eq(stepCPU(cs), 5);
+    ck_assert_int_eq(cs->b, 0);
+}
+END_TEST
+
+//for C = 200 down to 1, call a subroutine that saves BC and mixes A up
+//with carries, and store the result at HL (from 0x1000)
+static byte loop_prog[] = {
+    0x31, 0x00, 0x1f, //LXI SP, 0x1f00
+    0x21, 0x00, 0x10, //LXI H, 0x1000
+    0x0e, 0xc8,       //MVI C, 200
+    0x79,             //loop: MOV A, C
+    0xcd, 0x20, 0x00, //CALL 0x0020
+    0x77,             //MOV M, A
+    0x23,             //INX H
+    0x0d,             //DCR C
+    0xc2, 0x08, 0x00, //JNZ loop
+    0x76,             //HLT
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0xc5,             //0x20: PUSH B
+    0xc6, 0x07,       //ADI 7
+    0xee, 0x5a,       //XRI 0x5a
+    0x07,             //RLC
+    0xce, 0x03,       //ACI 3
+    0xc1,             //POP B
+    0xc9              //RET
+};
+
+//each pass stores A + 1 into the operand of the MVI that loads A,
+//until it reaches 200
+static byte patching_prog[] = {
+    0x0c,             //loop: INR C
+    0x3e, 0x00,       //MVI A, 0
+    0x3c,             //INR A
+    0x32, 0x02, 0x00, //STA 0x0002
+    0xfe, 0xc8,       //CPI 200
+    0xc2, 0x00, 0x00, //JNZ loop
+    0x76              //HLT
+};
+
+//flags that are set and never read, read in part (the carry by ACI,
+//carry and aux carry by DAA) and read whole by PUSH PSW
+static byte flags_prog[] = {
+    0x31, 0x00, 0x1f, //LXI SP, 0x1f00
+    0x06, 0x00,       //MVI B, 0
+    0x37,             //loop: STC
+    0x04,             //INR B
+    0x3e, 0xff,       //MVI A, 0xff
+    0xce, 0x00,       //ACI 0
+    0x3c,             //INR A
+    0xf5,             //PUSH PSW
+    0xd1,             //POP D
+    0x80,             //ADD B
+    0x27,             //DAA
+    0x81,             //ADD C
+    0x4f,             //MOV C, A
+    0x78,             //MOV A, B
+    0xfe, 0xc8,       //CPI 200
+    0xc2, 0x05, 0x00, //JNZ loop
+    0x76              //HLT
+};
+
+//run prog (loaded at 0) to its HLT with runCPU, in cs with the JIT (if
+//the core has one) or threaded blocks, and in a state with neither,
+//and check that they end up the same
+static void check_translated_run(byte *prog, int len, int jit) {
+    CPUState *ref = newState(8192);
+    int cycles = 0, ref_cycles = 0;
+    for (int i = 0; i < len; i++) cs->memory[i] = ref->memory[i] = prog[i];
+    if (jit) enableJIT(cs);
+    else enableThreadedBlocks(cs);
+    for (int i = 0; i < 200; i++) {
+        cycles += runCPU(cs, 997);
+        ref_cycles += runCPU(ref, 997);
+        ck_assert_int_eq(cycles, ref_cycles);
+        ck_assert_int_eq(cs->pc, ref->pc);
+    }
+    ck_assert_int_eq(cs->memory[cs->pc], 0x76);
+    ck_assert_int_eq(cs->a, ref->a);
+    ck_assert_int_eq(cs->bc, ref->bc);
+    ck_assert_int_eq(cs->de, ref->de);
+    ck_assert_int_eq(cs->hl, ref->hl);
+    ck_assert_int_eq(cs->sp, ref->sp);
+    ck_assert_int_eq(cs->fl.psw, ref->fl.psw);
+    for (int i = 0; i < 8192; i++)
+        ck_assert_int_eq(cs->memory[i], ref->memory[i]);
+    destroyState(ref);
+}
+
+static void check_loop(int jit) {
+    check_translated_run(loop_prog, sizeof(loop_prog), jit);
+    ck_assert_int_eq(cs->c, 0);
+    ck_assert_int_eq(cs->hl, 0x10c8);
+}
+
+static void check_patching(int jit) {
+    check_translated_run(patching_prog, sizeof(patching_prog), jit);
+    ck_assert_int_eq(cs->c, 200);
+    ck_assert_int_eq(cs->memory[2], 200);
+    ck_assert_int_eq(cs->pc, 0x000c);
+}
+
+static void check_flags(int jit) {
+    check_translated_run(flags_prog, sizeof(flags_prog), jit);
+    ck_assert_int_eq(cs->b, 200);
+    ck_assert_int_eq(cs->de, 0x0103);
+}
+
+//run the loop from ROM in two other states sharing code with cs, one
+//with a different constant in the subroutine, then in cs. cs has to
+//take the code the one with the same bytes decoded, and not the other.
+static void check_shared(int jit) {
+    SharedCode *sc = newSharedCode();
+    CPUState *other[2];
+    for (int n = 0; n < 2; n++) {
+        other[n] = newState(8192);
+        for (size_t i = 0; i < sizeof(loop_prog); i++)
+            other[n]->memory[i] = loop_prog[i];
+        other[n]->memory[0x22] = n ? 0x07 : 0x08; //ADI
+        mapPages(other[n], 0, 1, other[n]->memory, NULL);
+        shareDecodeCache(other[n], sc);
+        if (jit) enableJIT(other[n]);
+        else enableThreadedBlocks(other[n]);
+        while (!other[n]->halted) runCPU(other[n], 997);
+    }
+    for (size_t i = 0; i < sizeof(loop_prog); i++)
+        cs->memory[i] = loop_prog[i];
+    mapPages(cs, 0, 1, cs->memory, NULL);
+    shareDecodeCache(cs, sc);
+    //the states keep it until they are destroyed
+    releaseSharedCode(sc);
+    check_loop(jit);
+    for (int i = 0x1000; i < 0x10c8; i++)
+        ck_assert_int_eq(other[1]->memory[i], cs->memory[i]);
+    ck_assert_int_ne(other[0]->memory[0x1000], cs->memory[0x1000]);
+    destroyState(other[0]);
+    destroyState(other[1]);
+}
+
+//run the self-modifying program with dirty page tracking on, which has
+//to leave the decode cache seeing its writes. it only writes page 0.
+static void check_dirty(int jit) {
+    byte dirty[256];
+    trackDirtyPages(cs);
+    check_patching(jit);
+    ck_assert_int_eq(getDirtyPages(cs, dirty), 1);
+    ck_assert_int_eq(dirty[0], 1);
+}
+
+//save the decode cache after running the loop, then run it again in a
+//new state started off from the file. it is only taken if memory holds
+//the same code.
+static void check_saved(int jit) {
+    const char *path = "test_decode_saved.tmp";
+    //without a JIT there is nothing to save
+    if (jit && !enableJIT(cs)) return;
+    check_loop(jit);
+    ck_assert_int_eq(saveDecodeCache(cs, path), 1);
+    destroyState(cs);
+    cs = newState(8192);
+    if (jit) enableJIT(cs);
+    else enableThreadedBlocks(cs);
+    for (size_t i = 0; i < sizeof(loop_prog); i++)
+        cs->memory[i] = loop_prog[i];
+    cs->memory[0x22] = 0x08; //ADI 8
+    ck_assert_int_eq(loadDecodeCache(cs, path), 0);
+    cs->memory[0x22] = 0x07;
+    ck_assert_int_eq(loadDecodeCache(cs, path), 1);
+    remove(path);
+    check_loop(jit);
+}
+
+START_TEST (test_threaded_ports)
+{
+    enableThreadedBlocks(cs);
+    check_ports();
+}
+END_TEST
+
+START_TEST (test_jit_ports)
+{
+    if (!enableJIT(cs)) return;
+    check_ports();
+}
+END_TEST
+
+START_TEST (test_threaded_loop)
+{
+    check_loop(0);
+}
+END_TEST
+
+START_TEST (test_threaded_self_modifying)
+{
+    check_patching(0);
+}
+END_TEST
+
+START_TEST (test_threaded_dead_flags)
+{
+    check_flags(0);
+}
+END_TEST
+
+START_TEST (test_threaded_saved)
+{
+    check_saved(0);
+}
+END_TEST
+
+START_TEST (test_threaded_shared)
+{
+    check_shared(0);
+}
+END_TEST
+
+START_TEST (test_threaded_dirty)
+{
+    check_dirty(0);
+}
+END_TEST
+
+START_TEST (test_jit_loop)
+{
+    check_loop(1);
+}
+END_TEST
+
+START_TEST (test_jit_self_modifying)
+{
+    check_patching(1);
+}
+END_TEST
+
+START_TEST (test_jit_dead_flags)
+{
+    check_flags(1);
+}
+END_TEST
+
+START_TEST (test_jit_saved)
+{
+    check_saved(1);
+}
+END_TEST
+
+START_TEST (test_jit_shared)
+{
+    check_shared(1);
+}
+END_TEST
+
+START_TEST (test_jit_dirty)
+{
+    check_dirty(1);
+}
+END_TEST
+
 Suite *cpu_suite(void) {
     Suite *s;
 
@@ -1305,6 +2225,12 @@ Suite *cpu_suite(void) {
     TCase *tc_rets;
     TCase *tc_inter;
     TCase *tc_io;
+    TCase *tc_run;
+    TCase *tc_memory;
+    TCase *tc_map;
+    TCase *tc_decode;
+    TCase *tc_threaded;
+    TCase *tc_jit;
 
     s = suite_create("CPU Instructions");
 
@@ -1322,6 +2248,12 @@ Suite *cpu_suite(void) {
     tc_rets = tcase_create("Returns");
     tc_inter = tcase_create("Interrupt system instructions");
     tc_io = tcase_create("I/O bus instructions");
+    tc_run = tcase_create("Bulk execution");
+    tc_memory = tcase_create("Address space and traps");
+    tc_map = tcase_create("Memory map");
+    tc_decode = tcase_create("Decode cache");
+    tc_threaded = tcase_create("Threaded blocks");
+    tc_jit = tcase_create("JIT");
 
     tcase_add_checked_fixture(tc_carry, state_setup, state_teardown);
     tcase_add_checked_fixture(tc_single, state_setup, state_teardown);
@@ -1337,6 +2269,12 @@ Suite *cpu_suite(void) {
     tcase_add_checked_fixture(tc_rets, state_setup, state_teardown);
     tcase_add_checked_fixture(tc_inter, state_setup, state_teardown);
     tcase_add_checked_fixture(tc_io, state_setup, state_teardown);
+    tcase_add_checked_fixture(tc_run, state_setup, state_teardown);
+    tcase_add_checked_fixture(tc_memory, state_setup, state_teardown);
+    tcase_add_checked_fixture(tc_map, state_setup, state_teardown);
+    tcase_add_checked_fixture(tc_decode, state_setup, state_teardown);
+    tcase_add_checked_fixture(tc_threaded, state_setup, state_teardown);
+    tcase_add_checked_fixture(tc_jit, state_setup, state_teardown);
 
     tcase_add_test(tc_carry, test_stc);
     tcase_add_test(tc_carry, test_cmc);
@@ -1451,6 +2389,52 @@ Suite *cpu_suite(void) {
 
     tcase_add_test(tc_io, test_in);
     tcase_add_test(tc_io, test_out);
+    tcase_add_test(tc_io, test_port_handlers);
+
+    tcase_add_test(tc_run, test_run_budget);
+    tcase_add_test(tc_run, test_run_hlt);
+    tcase_add_test(tc_run, test_run_out);
+    tcase_add_test(tc_run, test_run_superinstructions);
+    tcase_add_test(tc_run, test_run_idle_loop);
+    tcase_add_test(tc_run, test_step_table);
+    tcase_add_test(tc_run, test_run_hooks);
+    tcase_add_test(tc_run, test_run_breakpoint);
+
+    tcase_add_test(tc_memory, test_top_of_memory);
+    tcase_add_test(tc_memory, test_state_with_host);
+#ifndef CPU_CHECKS
+    tcase_add_test(tc_memory, test_wrap_push);
+    tcase_add_test(tc_memory, test_wrap_lhld);
+#else
+    tcase_add_test(tc_memory, test_trap_stack_overflow);
+    tcase_add_test(tc_memory, test_trap_bad_address);
+#endif
+
+    tcase_add_test(tc_map, test_map_rom);
+    tcase_add_test(tc_map, test_map_mirror);
+    tcase_add_test(tc_map, test_map_handlers);
+    tcase_add_test(tc_map, test_map_page_crossing);
+    tcase_add_test(tc_map, test_map_dirty);
+
+    tcase_add_test(tc_decode, test_decode_patched_operand);
+    tcase_add_test(tc_decode, test_decode_patched_mirror);
+    tcase_add_test(tc_decode, test_decode_flush);
+
+    tcase_add_test(tc_threaded, test_threaded_loop);
+    tcase_add_test(tc_threaded, test_threaded_self_modifying);
+    tcase_add_test(tc_threaded, test_threaded_dead_flags);
+    tcase_add_test(tc_threaded, test_threaded_saved);
+    tcase_add_test(tc_threaded, test_threaded_shared);
+    tcase_add_test(tc_threaded, test_threaded_dirty);
+    tcase_add_test(tc_threaded, test_threaded_ports);
+
+    tcase_add_test(tc_jit, test_jit_loop);
+    tcase_add_test(tc_jit, test_jit_self_modifying);
+    tcase_add_test(tc_jit, test_jit_dead_flags);
+    tcase_add_test(tc_jit, test_jit_saved);
+    tcase_add_test(tc_jit, test_jit_shared);
+    tcase_add_test(tc_jit, test_jit_dirty);
+    tcase_add_test(tc_jit, test_jit_ports);
 
     suite_add_tcase(s, tc_carry);
     suite_add_tcase(s, tc_single);
@@ -1466,6 +2450,12 @@ Suite *cpu_suite(void) {
     suite_add_tcase(s, tc_rets);
     suite_add_tcase(s, tc_inter);
     suite_add_tcase(s, tc_io);
+    suite_add_tcase(s, tc_run);
+    suite_add_tcase(s, tc_memory);
+    suite_add_tcase(s, tc_map);
+    suite_add_tcase(s, tc_decode);
+    suite_add_tcase(s, tc_threaded);
+    suite_add_tcase(s, tc_jit);
 
     return s;
 }
@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <check.h>
+#include "cpu.h"
+
+/*
+    Exhaustive checks of the flag computations in the CPU core against a
+    straightforward reference implementation (the bit-counting parity and
+    hand-worked carry logic the core used before it switched to lookup
+    tables). Every operand pair is run with both values of the carry flag.
+*/
+
+CPUState* cs;
+
+void state_setup(void) {
+    cs = newState(8192);
+}
+
+void state_teardown(void) {
+    destroyState(cs);
+}
+
+typedef struct RefResult {
+    byte a;
+    byte z, s, p, cy, ac;
+} RefResult;
+
+static byte ref_parity(byte b) {
+    int set = 0;
+    while (b > 0) {
+        set += b % 2;
+        b /= 2;
+    }
+    return !(set % 2);
+}
+
+static void ref_flags(uint16_t res, RefResult *r) {
+    r->z = (res & 0xff) == 0;
+    r->s = (res & 0x80) != 0;
+    r->cy = res > 0xff;
+    r->p = ref_parity(res & 0xff);
+}
+
+//opcodes for the B register form of each accumulator instruction
+enum { ADD = 0x80, ADC = 0x88, SUB = 0x90, SBB = 0x98,
+       ANA = 0xa0, XRA = 0xa8, ORA = 0xb0, CMP = 0xb8 };
+
+static RefResult ref_alu(byte op, byte a, byte b, byte cy, byte ac) {
+    RefResult r = {a, 0, 0, 0, cy, ac};
+    uint16_t res;
+    byte r2;
+    switch (op) {
+        case ADD: case ADC:
+        {
+            byte cin = op == ADC ? cy : 0;
+            res = a + b + cin;
+            r.ac = (a & 0x0f) + (b & 0x0f) + cin > 0x0f;
+            ref_flags(res, &r);
+            r.a = res & 0xff;
+            break;
+        }
+        case SUB: case SBB: case CMP:
+        {
+            byte cin = op == SBB ? !cy : 1;
+            r2 = ~b;
+            res = a + r2 + cin;
+            r.ac = (a & 0x0f) + (r2 & 0x0f) + cin > 0x0f;
+            ref_flags(res, &r);
+            r.cy = !r.cy;
+            if (op != CMP) r.a = res & 0xff;
+            break;
+        }
+        case ANA:
+        {
+            res = a & b;
+            r.ac = ((a | b) & 0x08) != 0;
+            ref_flags(res, &r);
+            r.a = res;
+            break;
+        }
+        case XRA: case ORA:
+        {
+            res = op == XRA ? a ^ b : a | b;
+            ref_flags(res, &r);
+            r.ac = 0;
+            r.a = res;
+            break;
+        }
+    }
+    return r;
+}
+
+static RefResult ref_daa(byte a, byte cy, byte ac) {
+    RefResult r = {a, 0, 0, 0, cy, ac};
+    uint16_t acc = a;
+    int cflag = cy;
+    if ((acc & 0x0f) > 0x9 || ac) {
+        r.ac = (acc & 0x0f) > 0x09;
+        acc += 0x06;
+    }
+    if (acc >= 0xa0 || cy) {
+        acc += 0x60;
+        cflag = 1;
+    }
+    ref_flags(acc, &r);
+    r.cy = cflag;
+    r.a = acc & 0xff;
+    return r;
+}
+
+static void check_flags(RefResult *r) {
+    ck_assert_int_eq(cs->fl.z, r->z);
+    ck_assert_int_eq(cs->fl.s, r->s);
+    ck_assert_int_eq(cs->fl.p, r->p);
+    ck_assert_int_eq(cs->fl.cy, r->cy);
+    ck_assert_int_eq(cs->fl.ac, r->ac);
+}
+
+//run op on every accumulator, operand and carry-in combination
+static void check_alu(byte op) {
+    cs->memory[0] = op;
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            for (int cy = 0; cy < 2; cy++) {
+                RefResult r = ref_alu(op, a, b, cy, !cy);
+                cs->pc = 0;
+                cs->a = a;
+                cs->b = b;
+                cs->fl.cy = cy;
+                cs->fl.ac = !cy;
+                ck_assert_int_eq(stepCPU(cs), 4);
+                ck_assert_int_eq(cs->a, r.a);
+                check_flags(&r);
+            }
+        }
+    }
+}
+
+START_TEST (test_add_flags)
+{
+    check_alu(ADD);
+}
+END_TEST
+
+START_TEST (test_adc_flags)
+{
+    check_alu(ADC);
+}
+END_TEST
+
+START_TEST (test_sub_flags)
+{
+    check_alu(SUB);
+}
+END_TEST
+
+START_TEST (test_sbb_flags)
+{
+    check_alu(SBB);
+}
+END_TEST
+
+START_TEST (test_cmp_flags)
+{
+    check_alu(CMP);
+}
+END_TEST
+
+START_TEST (test_logical_flags)
+{
+    check_alu(ANA);
+    check_alu(XRA);
+    check_alu(ORA);
+}
+END_TEST
+
+START_TEST (test_inr_dcr_flags)
+{
+    for (int v = 0; v < 256; v++) {
+        for (int cy = 0; cy < 2; cy++) {
+            //INR B
+            cs->memory[0] = 0x04;
+            cs->pc = 0;
+            cs->b = v;
+            cs->fl.cy = cy;
+            ck_assert_int_eq(stepCPU(cs), 5);
+            RefResult r = {0, 0, 0, 0, 0, (v & 0x0f) == 0x0f};
+            ref_flags((v + 1) & 0xff, &r);
+            r.cy = cy;
+            ck_assert_int_eq(cs->b, (v + 1) & 0xff);
+            check_flags(&r);
+
+            //DCR B
+            cs->memory[0] = 0x05;
+            cs->pc = 0;
+            cs->b = v;
+            cs->fl.cy = cy;
+            ck_assert_int_eq(stepCPU(cs), 5);
+            r.ac = (v & 0x0f) != 0x00;
+            ref_flags((v - 1) & 0xff, &r);
+            r.cy = cy;
+            ck_assert_int_eq(cs->b, (v - 1) & 0xff);
+            check_flags(&r);
+        }
+    }
+}
+END_TEST
+
+START_TEST (test_daa_flags)
+{
+    cs->memory[0] = 0x27;
+    for (int a = 0; a < 256; a++) {
+        for (int cy = 0; cy < 2; cy++) {
+            for (int ac = 0; ac < 2; ac++) {
+                RefResult r = ref_daa(a, cy, ac);
+                cs->pc = 0;
+                cs->a = a;
+                cs->fl.cy = cy;
+                cs->fl.ac = ac;
+                ck_assert_int_eq(stepCPU(cs), 4);
+                ck_assert_int_eq(cs->a, r.a);
+                check_flags(&r);
+            }
+        }
+    }
+}
+END_TEST
+
+//check a Jcc with condition code cc (in opcode order NZ, Z, NC, C,
+//PO, PE, P, M) against the flags as the core reports them
+static void check_jump(int cc) {
+    int taken[8] = {!cs->fl.z, cs->fl.z, !cs->fl.cy, cs->fl.cy,
+                    !cs->fl.p, cs->fl.p, !cs->fl.s, cs->fl.s};
+    cs->memory[0x100] = 0xc2 | cc << 3;
+    cs->memory[0x101] = 0x00;
+    cs->memory[0x102] = 0x10;
+    cs->pc = 0x100;
+    ck_assert_int_eq(stepCPU(cs), 10);
+    ck_assert_int_eq(cs->pc, taken[cc] ? 0x1000 : 0x103);
+}
+
+START_TEST (test_conditions)
+{
+    for (int v = 0; v < 256; v++) {
+        for (int cc = 0; cc < 8; cc++) {
+            //flags set directly as a PSW byte
+            cs->fl.psw = v;
+            check_jump(cc);
+
+            //flags left by an ORA A, then STC if bit 0 is set
+            cs->memory[0] = 0xb7;
+            cs->memory[1] = v & 1 ? 0x37 : 0x00;
+            cs->pc = 0;
+            cs->a = v;
+            stepCPU(cs);
+            stepCPU(cs);
+            check_jump(cc);
+        }
+    }
+}
+END_TEST
+
+START_TEST (test_psw_round_trip)
+{
+    //POP PSW then PUSH PSW gives back the flag byte, with bit 1 set
+    //and bits 3 and 5 clear
+    cs->memory[0] = 0xf1;
+    cs->memory[1] = 0xf5;
+    for (int v = 0; v < 256; v++) {
+        cs->pc = 0;
+        cs->sp = 0x1000;
+        cs->memory[0x1000] = v;
+        cs->memory[0x1001] = 0x5a;
+        ck_assert_int_eq(stepCPU(cs), 10);
+        ck_assert_int_eq(cs->fl.psw, (v & 0xd7) | 0x02);
+        ck_assert_int_eq(stepCPU(cs), 11);
+        ck_assert_int_eq(cs->sp, 0x1000);
+        ck_assert_int_eq(cs->memory[0x1000], (v & 0xd7) | 0x02);
+        ck_assert_int_eq(cs->memory[0x1001], 0x5a);
+    }
+}
+END_TEST
+
+Suite *flags_suite(void) {
+    Suite *s;
+
+    TCase *tc_arithmetic;
+    TCase *tc_other;
+
+    s = suite_create("Flags");
+
+    tc_arithmetic = tcase_create("Arithmetic flags");
+    tc_other = tcase_create("Other flags and conditions");
+
+    tcase_add_checked_fixture(tc_arithmetic, state_setup, state_teardown);
+    tcase_add_checked_fixture(tc_other, state_setup, state_teardown);
+
+    tcase_add_test(tc_arithmetic, test_add_flags);
+    tcase_add_test(tc_arithmetic, test_adc_flags);
+    tcase_add_test(tc_arithmetic, test_sub_flags);
+    tcase_add_test(tc_arithmetic, test_sbb_flags);
+    tcase_add_test(tc_arithmetic, test_cmp_flags);
+
+    tcase_add_test(tc_other, test_logical_flags);
+    tcase_add_test(tc_other, test_inr_dcr_flags);
+    tcase_add_test(tc_other, test_daa_flags);
+    tcase_add_test(tc_other, test_conditions);
+    tcase_add_test(tc_other, test_psw_round_trip);
+
+    suite_add_tcase(s, tc_arithmetic);
+    suite_add_tcase(s, tc_other);
+
+    return s;
+}
+
+int main(void) {
+    int number_failed;
+    Suite *s;
+    SRunner *sr;
+
+    s = flags_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <check.h>
+#include "cpu.h"
+#include "opcodes.h"
+#include "machine.h"
+
+/*
+    Checks of the Space Invaders machine layer: that its cycle clock,
+    which times the interrupts, keeps in step with the cycles the CPU
+    actually runs, interrupts included.
+*/
+
+extern const int cycles_per_frame;
+
+Machine *m;
+
+void machine_setup(void) {
+    m = newMachine();
+}
+
+void machine_teardown(void) {
+    destroyMachine(m);
+}
+
+#define CYCLES_ENTRY(code, handler, len, cycles, ...) [code] = cycles,
+static const int opcycles[256] = { OPCODE_TABLE(CYCLES_ENTRY) };
+
+//adds up the cycles of the instructions the CPU runs (the program below
+//has no conditional branches, so that is the cycles in the table)
+static int count_cycles(void *ctx, CPUState *cs, const byte *opcode) {
+    *(uint64_t *) ctx += opcycles[opcode[0]];
+    return 0;
+}
+
+//JMP 0040, then at 0008 (RST 1) and 0010 (RST 2, by way of 0018)
+//handlers that count their interrupts at 2000 and 2001 and return with
+//interrupts enabled, and at 0040 a loop with them enabled
+static const byte program[] = {
+    0xc3, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xe5, 0x21, 0x00, 0x20, 0x34, 0xe1, 0xfb, 0xc9,
+    0xc3, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xe5, 0x21, 0x01, 0x20, 0x34, 0xe1, 0xfb, 0xc9
+};
+//LXI SP,2400; EI; loop: INX B; JMP loop
+static const byte loop[] = {0x31, 0x00, 0x24, 0xfb, 0x03, 0xc3, 0x44, 0x00};
+
+START_TEST (test_clock_counts_interrupts)
+{
+    uint64_t ran = 0;
+    CPUHooks hooks = {count_cycles, NULL, NULL, NULL, NULL, NULL, &ran};
+    for (size_t i = 0; i < sizeof(program); i++)
+        m->cs->memory[i] = program[i];
+    for (size_t i = 0; i < sizeof(loop); i++)
+        m->cs->memory[0x40 + i] = loop[i];
+    setCPUHooks(m->cs, &hooks);
+
+    int frames = 100;
+    for (int f = 0; f < frames; f++) stepFrame(m);
+
+    //every interrupt was taken, each costing an RST's cycles (the last
+    //vblank's handler hasn't run yet, as the frame ends as it is taken)
+    ck_assert_int_eq(m->cs->memory[0x2000], frames);
+    ck_assert_int_eq(m->cs->memory[0x2001], frames - 1);
+    ck_assert_int_eq(m->cs->pc, 0x10);
+    uint64_t interrupts = 2 * frames;
+    ck_assert_uint_eq(m->events.now, ran + interrupts * opcycles[0xcf]);
+    //and the frames end on time: with the last vblank taken, after no
+    //more than the part of an instruction (from the loop) the last run
+    //went past it by
+    uint64_t vblank = (uint64_t) frames * cycles_per_frame + opcycles[0xd7];
+    ck_assert_uint_ge(m->events.now, vblank);
+    ck_assert_uint_lt(m->events.now, vblank + opcycles[0xc3]);
+}
+END_TEST
+
+Suite *machine_suite(void) {
+    Suite *s;
+    TCase *tc_clock;
+
+    s = suite_create("Machine");
+
+    tc_clock = tcase_create("Cycle clock");
+
+    tcase_add_checked_fixture(tc_clock, machine_setup, machine_teardown);
+
+    tcase_add_test(tc_clock, test_clock_counts_interrupts);
+
+    suite_add_tcase(s, tc_clock);
+
+    return s;
+}
+
+int main(void) {
+    int number_failed;
+    Suite *s;
+    SRunner *sr;
+
+    s = machine_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}